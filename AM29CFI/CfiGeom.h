@@ -0,0 +1,29 @@
+/***********************************************************************/
+/*                                                                     */
+/*  CfiGeom.h:  Expected Geometry of the CFI Device, used for the      */
+/*              Sector Table (FlashDev.c) and checked by Init          */
+/*              (FlashPrg.c). FlashDevice is not downloaded to the     */
+/*              Target, so the Algorithm uses these Defines instead.   */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef CFI_SIZE
+#define CFI_SIZE   0x400000    // Size of one Device (4MB)
+#endif
+#ifndef CFI_BLOCK
+#define CFI_BLOCK  0x10000     // Main Block Size of one Device (64kB)
+#endif
+#ifndef CFI_BOOT
+#define CFI_BOOT   1           // Boot Blocks 8 x 8kB: 0-none, 1-bottom, 2-top
+#endif
+
+#ifdef CFI_32BIT
+#define CFI_N      2           // Devices on the Bus
+#else
+#define CFI_N      1
+#endif
+
+#define SZ_DEV     (CFI_SIZE  * CFI_N)
+#define SZ_BLK     (CFI_BLOCK * CFI_N)
+#define SZ_BOOT    (0x2000    * CFI_N)
+#define NUM_BOOT   8           // Number of Boot Blocks
@@ -0,0 +1,88 @@
+/***********************************************************************/
+/*  This file is part of the ARM Toolchain package                     */
+/*  Copyright KEIL ELEKTRONIK GmbH 2003 - 2006                         */
+/***********************************************************************/
+/*                                                                     */
+/*  FlashDev.C:  Device Description for CFI AMD/Spansion Flash         */
+/*               (8-bit, 16-bit or 2x 16-bit Bus)                      */
+/*                                                                     */
+/*  Sector Table must match the Erase Blocks of the Device, Init       */
+/*  fails when the CFI Geometry differs (see FlashPrg.c).              */
+/*  Bus Width:  default 16-bit, define CFI_8BIT or CFI_32BIT           */
+/*  Geometry:   CFI_SIZE, CFI_BLOCK, CFI_BOOT (see CfiGeom.h)          */
+/*  Targets:    AM29CFI (ARM7TDMI): ProgramPage only, ARM7 has no      */
+/*              Memory Access while the Core runs, so the Build has    */
+/*              no ProgramPages (Double Buffer)                        */
+/*              AM29CFI Cortex-M: also ProgramPages (FlashDblBuf.H)    */
+/*                                                                     */
+/***********************************************************************/
+
+#include "../FlashOS.H"        // FlashOS Structures
+#include "CfiGeom.h"           // Device Geometry
+
+
+#if   CFI_BOOT == 1
+#define SECTORS    SZ_BOOT, 0, SZ_BLK, NUM_BOOT * SZ_BOOT,
+#elif CFI_BOOT == 2
+#define SECTORS    SZ_BLK, 0, SZ_BOOT, SZ_DEV - NUM_BOOT * SZ_BOOT,
+#else
+#define SECTORS    SZ_BLK, 0,
+#endif
+
+
+#ifdef CFI_8BIT
+struct FlashDevice const FlashDevice  =  {
+   FLASH_DRV_VERS,             // Driver Version, do not modify!
+   "AM29 CFI Flash (8-bit)",   // Device Name
+   EXT8BIT,                    // Device Type
+   0x000000,                   // Device Start Address
+   SZ_DEV,                     // Device Size in Bytes
+   1024,                       // Programming Page Size
+   0,                          // Reserved, must be 0
+   0xFF,                       // Initial Content of Erased Memory
+   100,                        // Program Page Timeout 100 mSec
+   3000,                       // Erase Sector Timeout 3000 mSec
+
+// Specify Size and Address of Sectors
+   SECTORS                     // Boot and Main Blocks
+   SECTOR_END
+};
+#endif
+
+#ifdef CFI_32BIT
+struct FlashDevice const FlashDevice  =  {
+   FLASH_DRV_VERS,             // Driver Version, do not modify!
+   "AM29 CFI Dual Flash",      // Device Name
+   EXT32BIT,                   // Device Type
+   0x000000,                   // Device Start Address
+   SZ_DEV,                     // Device Size in Bytes
+   1024,                       // Programming Page Size
+   0,                          // Reserved, must be 0
+   0xFF,                       // Initial Content of Erased Memory
+   100,                        // Program Page Timeout 100 mSec
+   3000,                       // Erase Sector Timeout 3000 mSec
+
+// Specify Size and Address of Sectors
+   SECTORS                     // Boot and Main Blocks
+   SECTOR_END
+};
+#endif
+
+#if !defined(CFI_8BIT) && !defined(CFI_32BIT)
+struct FlashDevice const FlashDevice  =  {
+   FLASH_DRV_VERS,             // Driver Version, do not modify!
+   "AM29 CFI Flash (16-bit)",  // Device Name
+   EXT16BIT,                   // Device Type
+   0x000000,                   // Device Start Address
+   SZ_DEV,                     // Device Size in Bytes
+   1024,                       // Programming Page Size
+   0,                          // Reserved, must be 0
+   0xFF,                       // Initial Content of Erased Memory
+   100,                        // Program Page Timeout 100 mSec
+   3000,                       // Erase Sector Timeout 3000 mSec
+
+// Specify Size and Address of Sectors
+   SECTORS                     // Boot and Main Blocks
+   SECTOR_END
+};
+#endif
@@ -0,0 +1,739 @@
+/***********************************************************************/
+/*  This file is part of the ARM Toolchain package                     */
+/*  Copyright KEIL ELEKTRONIK GmbH 2003 - 2006                         */
+/***********************************************************************/
+/*                                                                     */
+/*  FlashDev.C:  Flash Programming Functions adapted                   */
+/*               for CFI AMD/Spansion Flash (8/16/32-bit Bus)          */
+/*                                                                     */
+/*  Init issues the CFI Query and detects Bus Width, Interleave,       */
+/*  Erase Block Regions, Write Buffer Size and Timeouts. Write Buffer  */
+/*  Programming is used when reported, else Unlock Bypass Programming. */
+/*                                                                     */
+/***********************************************************************/
+
+#include "../FlashOS.H"        // FlashOS Structures
+#include "../FlashQueue.H"     // Command Queue (RunQueue)
+#include "../FlashDblBuf.H"    // Double Buffer (ProgramPages)
+#include "CfiGeom.h"           // Device Geometry (Sector Table)
+
+#ifndef FLASH_SIM              // Host Simulator: Accesses to Flash Model
+#define M8(adr)  (*((volatile unsigned char  *) (adr)))
+#define M16(adr) (*((volatile unsigned short *) (adr)))
+#define M32(adr) (*((volatile unsigned long  *) (adr)))
+#endif
+
+#define STACK_SIZE   64        // Stack Size
+
+#define UNLOCK_BYPASS 1        // Unlock Bypass Programming (0 - Disabled)
+#define SKIP_EMPTY    1        // Skip Words equal to Erased Value (0 - Disabled)
+#define ERASE_SKIP    1        // Skip Erase of blank Sectors (0 - Disabled)
+#define WRITE_BUFFER  1        // Write Buffer Programming if reported (0 - Disabled)
+#define RGN_MAX       4        // Max. Number of Erase Block Regions
+#define POLL_CYCLES   16       // CPU Cycles per Poll Iteration (lower Bound)
+#if defined(__TARGET_ARCH_7_M) || defined(FLASH_SIM)
+#define DBL_BUF       1        // ProgramPages (Host writes while Target runs)
+#else
+#define DBL_BUF       0        // ARM7: no Memory Access while running
+#endif
+#define DB_WAIT       0x1000000  // Host Wait Limit (Poll Iterations)
+
+
+struct cfimode {               // Bus Configuration tried by CFI Query
+  unsigned char  bus;          // Bus Width in Bytes
+  unsigned char  step;         // Address Step per CFI Word
+  unsigned short ua1;          // Unlock Address 1 (Offset)
+  unsigned short ua2;          // Unlock Address 2 (Offset)
+};
+
+const struct cfimode cfi_mode[4] = {
+  { 4, 4, 0x1554, 0x0AA8 },    // 2x 16-bit Devices on 32-bit Bus
+  { 2, 2, 0x0AAA, 0x0554 },    // 16-bit Device
+  { 1, 2, 0x0AAA, 0x0555 },    // 16-bit Device in Byte Mode
+  { 1, 1, 0x0555, 0x02AA },    // 8-bit Device
+};
+
+unsigned long base_adr;
+unsigned long ub_active;       // Unlock Bypass Mode entered
+unsigned long ub_session;      // Keep Unlock Bypass until UnInit
+unsigned long skip_cnt;        // Number of skipped erased Words
+unsigned long fail_adr;        // First Address failing Blank Check
+unsigned long erase_skip;      // Number of skipped Sector Erases
+unsigned long crc_tab[256];    // CRC32 Lookup Table
+
+#if DBL_BUF
+struct dbuf db[2];             // Double Buffer (see FlashDblBuf.H)
+DB_WORD     db_stat;           // ProgramPages Status (1 - Done, 2 - Failed)
+#endif
+
+unsigned long bus;             // Bus Width in Bytes (1, 2, 4)
+unsigned long step;            // Address Step per CFI Word
+unsigned long ua1, ua2;        // Unlock Addresses (Offsets)
+unsigned long rep;             // Command Multiplier (0x00010001 - 2 Devices)
+unsigned long emp;             // Erased Value of one Bus Word
+unsigned long wb_size;         // Write Buffer Size in Bytes (0 - Not used)
+unsigned long rgn_cnt;         // Number of Erase Block Regions
+unsigned long rgn_num[RGN_MAX];    // Number of Blocks in Region
+unsigned long rgn_size[RGN_MAX];   // Block Size in Region (all Devices)
+unsigned long to_prog;         // Word Program Deadline  (Poll Iterations,
+unsigned long to_buf;          // Buffer Program Deadline 0 - unlimited)
+unsigned long to_erase;        // Block Erase Deadline
+unsigned long to_chip;         // Chip Erase Deadline
+
+
+/*
+ *  Read / Write one Bus Word
+ */
+
+unsigned long Rd (unsigned long adr) {
+  switch (bus) {
+    case 1:  return (M8(adr));
+    case 2:  return (M16(adr));
+  }
+  return (M32(adr));
+}
+
+void Wr (unsigned long adr, unsigned long val) {
+  switch (bus) {
+    case 1:  M8(adr)  = val; break;
+    case 2:  M16(adr) = val; break;
+    default: M32(adr) = val; break;
+  }
+}
+
+
+/*
+ *  Get one Bus Word from Data Buffer
+ */
+
+unsigned long Get (unsigned char *buf) {
+  switch (bus) {
+    case 1:  return (*buf);
+    case 2:  return (*((unsigned short *) buf));
+  }
+  return (*((unsigned int *) buf));
+}
+
+
+/*
+ *  Write Command to all Devices
+ *    Parameter:      ofs:  Address Offset from Device Base
+ *                    cmd:  Command Byte
+ */
+
+void Cmd (unsigned long ofs, unsigned long cmd) {
+  Wr(base_adr + ofs, cmd * rep);
+}
+
+
+/*
+ *  Unlock Cycles (AA/55)
+ */
+
+void Unlock (void) {
+  Cmd(ua1, 0xAA);
+  Cmd(ua2, 0x55);
+}
+
+
+/*
+ *  Read CFI Query Byte
+ *    Parameter:      n:    CFI Word Address
+ *    Return Value:   Query Data (Device on low Lane)
+ */
+
+unsigned long Cfi (unsigned long n) {
+  return (Rd(base_adr + n * step) & 0xFF);
+}
+
+
+/*
+ *  Convert CFI Timeout into a Poll Deadline
+ *    Parameter:      typ:  Typical Time = 2^typ Units (0 - not supported)
+ *                    max:  Max. Time = 2^max * Typical (0 - not supported)
+ *                    clk:  Clock Frequency (Hz)
+ *                    unit: Units per Second (1000 - ms, 1000000 - us)
+ *    Return Value:   Number of Poll Iterations (0 - unlimited)
+ */
+
+unsigned long Deadline (unsigned long typ, unsigned long max,
+                        unsigned long clk, unsigned long unit) {
+  unsigned long n, e;
+
+  if ((typ == 0) || (max == 0) || (clk == 0)) return (0);
+
+  n = clk / POLL_CYCLES / unit;        // Poll Iterations per Unit
+  if (n == 0) n = 1;
+  for (e = typ + max + 1; e; e--) {    // 2^(typ+max) Units, 2x Margin
+    if (n & 0x80000000) return (0);    // Overflow: unlimited
+    n <<= 1;
+  }
+  return (n);
+}
+
+
+/*
+ *  Detect Device using CFI Query
+ *    Parameter:      clk:  Clock Frequency (Hz)
+ *    Return Value:   0 - OK,  1 - No AMD Command Set CFI Device
+ */
+
+int CfiQuery (unsigned long clk) {
+  unsigned long i, j, n, s, pri;
+
+  for (i = 0; i < 4; i++) {
+    bus  = cfi_mode[i].bus;
+    step = cfi_mode[i].step;
+    ua1  = cfi_mode[i].ua1;
+    ua2  = cfi_mode[i].ua2;
+    rep  = (bus == 4) ? 0x00010001 : 1;
+    Cmd(0, 0xF0);                      // Reset Device
+    Cmd(0x55 * step, 0x98);            // Enter CFI Query Mode
+    if ((Rd(base_adr + 0x10 * step) == 'Q' * rep) &&
+        (Rd(base_adr + 0x11 * step) == 'R' * rep) &&
+        (Rd(base_adr + 0x12 * step) == 'Y' * rep)) break;
+  }
+  if (i == 4) {
+    Cmd(0, 0xF0);
+    return (1);                        // No CFI Device
+  }
+  if ((Cfi(0x13) | (Cfi(0x14) << 8)) != 0x0002) {
+    Cmd(0, 0xF0);
+    return (1);                        // Not AMD Command Set
+  }
+
+  emp      = (bus == 4) ? 0xFFFFFFFF : ((bus == 2) ? 0xFFFF : 0xFF);
+  n        = (bus == 4) ? 2 : 1;       // Number of Devices
+
+  wb_size  = 0;
+  s        = Cfi(0x2A);                // Max. Bytes in Write Buffer = 2^s
+  if (WRITE_BUFFER && (s > 1) && (s < 10)) {
+    wb_size = (1 << s) * n;
+  }
+
+  rgn_cnt  = Cfi(0x2C);                // Erase Block Regions
+  if ((rgn_cnt == 0) || (rgn_cnt > RGN_MAX)) {
+    Cmd(0, 0xF0);
+    return (1);
+  }
+  for (i = 0; i < rgn_cnt; i++) {
+    rgn_num[i]  = (Cfi(0x2D + 4*i) | (Cfi(0x2E + 4*i) << 8)) + 1;
+    s           = (Cfi(0x2F + 4*i) | (Cfi(0x30 + 4*i) << 8)) * 256;
+    rgn_size[i] = (s ? s : 128) * n;
+  }
+
+  pri = Cfi(0x15) | (Cfi(0x16) << 8);  // Primary Extended Query
+  if ((Cfi(pri) == 'P') && (Cfi(pri + 1) == 'R') && (Cfi(pri + 2) == 'I') &&
+      (Cfi(pri + 0x0F) == 3) && (rgn_cnt > 1)) {
+    for (i = 0; i < rgn_cnt / 2; i++) {  // Top Boot: Regions listed reversed
+      j = rgn_cnt - 1 - i;
+      s = rgn_num[i];  rgn_num[i]  = rgn_num[j];  rgn_num[j]  = s;
+      s = rgn_size[i]; rgn_size[i] = rgn_size[j]; rgn_size[j] = s;
+    }
+  }
+
+  to_prog  = Deadline(Cfi(0x1F), Cfi(0x23), clk, 1000000);
+  to_buf   = Deadline(Cfi(0x20), Cfi(0x24), clk, 1000000);
+  to_erase = Deadline(Cfi(0x21), Cfi(0x25), clk, 1000);
+  to_chip  = Deadline(Cfi(0x22), Cfi(0x26), clk, 1000);
+
+  Cmd(0, 0xF0);                        // Return to Read Mode
+  return (0);
+}
+
+
+/*
+ *  Locate Erase Block containing an Address
+ *    Parameter:      adr:  Address
+ *                    blk:  Block Start Address (Output)
+ *    Return Value:   Block Size (0 - Address outside of Device)
+ */
+
+unsigned long BlockOf (unsigned long adr, unsigned long *blk) {
+  unsigned long ofs, sa, n, i;
+
+  ofs = adr - base_adr;
+  sa  = 0;
+  for (i = 0; i < rgn_cnt; i++) {
+    n = rgn_num[i] * rgn_size[i];
+    if (ofs < sa + n) {
+      *blk = base_adr + sa + ((ofs - sa) / rgn_size[i]) * rgn_size[i];
+      return (rgn_size[i]);
+    }
+    sa += n;
+  }
+  return (0);
+}
+
+
+/*
+ *  Check that every Sector of the Sector Table (CfiGeom.h) is one
+ *  Erase Block of the Device
+ *    Return Value:   0 - OK,  1 - Geometry does not match
+ */
+
+int GeometryCheck (void) {
+  unsigned long ofs, sz, blk;
+
+  for (ofs = 0; ofs < SZ_DEV; ofs += sz) {
+    sz = SZ_BLK;
+    if ((CFI_BOOT == 1) && (ofs < NUM_BOOT * SZ_BOOT))          sz = SZ_BOOT;
+    if ((CFI_BOOT == 2) && (ofs >= SZ_DEV - NUM_BOOT * SZ_BOOT)) sz = SZ_BOOT;
+    if (BlockOf(base_adr + ofs, &blk) != sz) return (1);
+    if (blk != base_adr + ofs) return (1);
+  }
+  return (0);
+}
+
+
+/*
+ * Check if Program/Erase completed (DQ6 Toggle Bit, all Devices)
+ *    Parameter:      adr:  Block Start Address
+ *                    n:    Deadline (Poll Iterations, 0 - unlimited)
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+int Polling (unsigned long adr, unsigned long n) {
+  unsigned long v1, v2, t;
+
+  v1 = Rd(adr);
+  do {
+    v2 = Rd(adr);
+    t  = (v1 ^ v2) & (0x40 * rep);     // Devices still toggling
+    if (t == 0) return (0);            // Done
+    v1 = v2;
+  } while ((((v2 << 1) & t) != t) &&   // Check for Timeout (DQ5)
+           ((n == 0) || --n));         // and Deadline
+  v1 = Rd(adr);
+  v2 = Rd(adr);
+  if (((v1 ^ v2) & (0x40 * rep)) == 0) return (0);   // Done
+  Cmd(0, 0xF0);                        // Reset Device
+  return (1);                          // Failed
+}
+
+
+/*
+ * Check if Program completed (DQ7 Data Polling, all Devices)
+ *    Parameter:      adr:  Last programmed Address
+ *                    dat:  Last programmed Data
+ *                    n:    Deadline (Poll Iterations, 0 - unlimited)
+ *                    wb:   Write Buffer Programming (check DQ1 Abort)
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+int PollingData (unsigned long adr, unsigned long dat,
+                 unsigned long n, int wb) {
+  unsigned long v, d, f;
+
+  do {
+    v = Rd(adr);
+    d = (v ^ dat) & (0x80 * rep);      // Devices not done
+    if (d == 0) return (0);            // Done
+    f = v << 2;                        // DQ5 Timeout
+    if (wb) f |= v << 6;               // DQ1 Write Buffer Abort
+  } while (((f & d) != d) && ((n == 0) || --n));
+  v = Rd(adr);
+  if (((v ^ dat) & (0x80 * rep)) == 0) return (0);   // Done
+  if (wb) Unlock();                    // Write to Buffer Abort Reset
+  Cmd(wb ? ua1 : 0, 0xF0);             // Reset Device
+  return (1);                          // Failed
+}
+
+
+/*
+ *  Enter Unlock Bypass Mode
+ */
+
+void BypassEnter (void) {
+  Unlock();
+  Cmd(ua1, 0x20);
+  ub_active = 1;
+}
+
+
+/*
+ *  Exit Unlock Bypass Mode
+ */
+
+void BypassExit (void) {
+  if (ub_active) {
+    Cmd(0, 0x90);                      // Unlock Bypass Reset
+    Cmd(0, 0x00);
+    ub_active = 0;
+  }
+}
+
+
+/*
+ *  Initialize Flash Programming Functions
+ *    Parameter:      adr:  Device Base Address
+ *                    clk:  Clock Frequency (Hz)
+ *                    fnc:  Function Code (1 - Erase, 2 - Program, 3 - Verify)
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+int Init (unsigned long adr, unsigned long clk, unsigned long fnc) {
+  base_adr   = adr;
+  ub_active  = 0;
+  ub_session = (fnc == 2);     // Program: stay in Unlock Bypass for Session
+  skip_cnt   = 0;
+  erase_skip = 0;
+  if (CfiQuery(clk) != 0) return (1);
+  return (GeometryCheck());    // Sector Table must match the Device
+}
+
+
+/*
+ *  De-Initialize Flash Programming Functions
+ *    Parameter:      fnc:  Function Code (1 - Erase, 2 - Program, 3 - Verify)
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+int UnInit (unsigned long fnc) {
+  BypassExit();
+  return (0);
+}
+
+
+/*
+ *  Blank Check Checks if Memory is Blank
+ *    Parameter:      adr:  Block Start Address
+ *                    sz:   Block Size (in bytes)
+ *                    pat:  Block Pattern
+ *    Return Value:   0 - OK,  1 - Failed (fail_adr: first failing Address)
+ */
+
+int BlankCheck (unsigned long adr, unsigned long sz, unsigned char pat) {
+  unsigned long v;
+
+  BypassExit();
+
+  v = pat * (0x01010101 & emp);
+  for ( ; sz >= bus; sz -= bus, adr += bus) {
+    if (Rd(adr) != v) break;   // Mismatch: locate Byte below
+  }
+  for ( ; sz; sz--, adr++) {
+    if (M8(adr) != pat) {
+      fail_adr = adr;
+      return (1);
+    }
+  }
+  return (0);
+}
+
+
+/*
+ *  Fast Blank Scan of a Block using 32-bit Reads
+ *    Parameter:      adr:  Block Start Address
+ *                    sz:   Block Size (in bytes)
+ *    Return Value:   1 - Blank,  0 - Not Blank
+ */
+
+int BlockBlank (unsigned long adr, unsigned long sz) {
+
+  for ( ; sz; sz -= 4, adr += 4) {
+    if (M32(adr) != 0xFFFFFFFF) return (0);
+  }
+  return (1);
+}
+
+
+/*
+ *  Erase complete Flash Memory
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+int EraseChip (void) {
+
+  BypassExit();
+
+  // Start Chip Erase Command
+  Unlock();
+  Cmd(ua1, 0x80);
+  Unlock();
+  Cmd(ua1, 0x10);
+
+  return (Polling(base_adr, to_chip));   // Wait until Erase completed
+}
+
+
+/*
+ *  Erase Sector in Flash Memory
+ *    Parameter:      adr:  Sector Address
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+int EraseSector (unsigned long adr) {
+  unsigned long blk, sz, v;
+
+  BypassExit();
+
+  sz = BlockOf(adr, &blk);
+  if (sz == 0)    return (1);  // Outside of Device
+  if (blk != adr) return (1);  // Not a Block Start: never erase more
+
+  if (ERASE_SKIP && BlockBlank(blk, sz)) {
+    erase_skip++;              // Already erased
+  } else {
+    // Start Erase Sector Command
+    Unlock();
+    Cmd(ua1, 0x80);
+    Unlock();
+    Wr(blk, 0x30 * rep);
+
+    do {
+      v = Rd(blk);
+    } while ((v & (0x08 * rep)) != (0x08 * rep));   // Wait for Sector Erase Timeout
+
+    if (Polling(blk, to_erase) != 0) {   // Wait until Erase completed
+      return (1);
+    }
+  }
+  return (0);
+}
+
+
+/*
+ *  Program Write Buffer in Flash Memory
+ *    Parameter:      adr:  Start Address (within one Write Buffer Page)
+ *                    n:    Number of Bus Words
+ *                    buf:  Data
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+int ProgramBuffer (unsigned long adr, unsigned long n, unsigned char *buf) {
+  unsigned long i;
+
+  // Start Write to Buffer Command
+  Unlock();
+  Wr(adr, 0x25 * rep);
+  Wr(adr, (n - 1) * rep);      // Word Count - 1
+  for (i = 0; i < n; i++) {    // Load Buffer
+    Wr(adr + i*bus, Get(buf + i*bus));
+  }
+  Wr(adr, 0x29 * rep);         // Program Buffer to Flash
+
+  i = (n - 1) * bus;           // Wait until Programming completed
+  return (PollingData(adr + i, Get(buf + i), to_buf, 1));
+}
+
+
+/*
+ *  Program Page in Flash Memory
+ *    Parameter:      adr:  Page Start Address
+ *                    sz:   Page Size
+ *                    buf:  Page Data
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+int ProgramPage (unsigned long adr, unsigned long sz, unsigned char *buf) {
+  unsigned long n, s, e, d;
+
+  sz = (sz + bus - 1) & ~(bus - 1);
+
+  if (wb_size != 0) {          // Write Buffer Programming
+    while (sz) {
+      n = wb_size - ((adr - base_adr) & (wb_size - 1));   // Bytes up to Buffer Boundary
+      if (n > sz) n = sz;
+      s = 0;
+      e = n;
+      if (SKIP_EMPTY) {        // Trim erased Words at both Ends
+        while ((s < e) && (Get(buf + s) == emp)) s += bus;
+        while ((e > s) && (Get(buf + e - bus) == emp)) e -= bus;
+        skip_cnt += (n - (e - s)) / bus;
+      }
+      if (e > s) {
+        if (ProgramBuffer(adr + s, (e - s) / bus, buf + s) != 0) return (1);
+      }
+      buf += n;
+      adr += n;
+      sz  -= n;
+    }
+    return (0);
+  }
+
+  if (UNLOCK_BYPASS && !ub_active) {
+    BypassEnter();
+  }
+  for ( ; sz; sz -= bus, adr += bus, buf += bus) {
+    d = Get(buf);
+    if (SKIP_EMPTY && (d == emp)) {
+      skip_cnt++;              // Erased Value: nothing to program
+      continue;
+    }
+    // Start Program Command
+    if (ub_active) {
+      Cmd(0, 0xA0);            // Unlock Bypass Program
+    } else {
+      Unlock();
+      Cmd(ua1, 0xA0);
+    }
+    Wr(adr, d);
+    if (PollingData(adr, d, to_prog, 0) != 0) {
+      BypassExit();
+      return (1);
+    }
+  }
+  if (!ub_session) BypassExit();
+  return (0);
+}
+
+
+#if DBL_BUF
+/*
+ *  Program Pages from the Double Buffer until the Host sends Size 0
+ *  (Host Side: Host/Sim/SimMain.cpp, -D)
+ *    Return Value:   0 - OK,  1 - Failed or Host Timeout (db_stat = 2)
+ */
+
+int ProgramPages (void) {
+  struct dbuf *b;
+  unsigned long i, n;
+
+  db_stat = 0;
+  for (i = 0; ; i ^= 1) {
+    b = &db[i];
+    for (n = DB_WAIT; b->state != DB_FULL; n--) {   // Wait for Host
+      if (n == 0) {
+        db_stat = 2;
+        return (1);
+      }
+    }
+    if (b->sz == 0) break;             // End of Data
+    if (ProgramPage(b->adr, b->sz, b->data) != 0) {
+      db_stat = 2;
+      return (1);
+    }
+    b->state = DB_EMPTY;
+  }
+  b->state = DB_EMPTY;
+  db_stat = 1;
+  return (0);
+}
+#endif
+
+
+/*
+ *  Verify Flash Contents
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes)
+ *                    buf:  Data
+ *    Return Value:   (adr+sz) - OK, Failed Address
+ */
+
+unsigned long Verify (unsigned long adr, unsigned long sz, unsigned char *buf) {
+
+  BypassExit();
+
+  for ( ; sz >= bus; sz -= bus, adr += bus, buf += bus) {
+    if (Rd(adr) != Get(buf)) break;
+  }
+  for ( ; sz; sz--, adr++, buf++) {
+    if (M8(adr) != *buf) break;
+  }
+  return (adr);
+}
+
+
+/*
+ *  Build CRC32 Lookup Table (reflected Polynomial 0xEDB88320)
+ */
+
+void CrcInit (void) {
+  unsigned long c;
+  int i, j;
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (j = 0; j < 8; j++) {
+      c = (c & 1) ? ((c >> 1) ^ 0xEDB88320) : (c >> 1);
+    }
+    crc_tab[i] = c;
+  }
+}
+
+
+/*
+ *  Calculate CRC32 of Flash Contents (same as zlib crc32)
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes)
+ *    Return Value:   CRC32 Value
+ */
+
+unsigned long Crc32 (unsigned long adr, unsigned long sz) {
+  unsigned long crc;
+
+  if (crc_tab[255] != 0x2D02EF8D) {  // Table not built yet
+    CrcInit();
+  }
+  BypassExit();
+
+  crc = 0xFFFFFFFF;
+  for ( ; sz && (adr & 3); sz--, adr++) {    // Leading Bytes
+    crc = crc_tab[(crc ^ M8(adr)) & 0xFF] ^ (crc >> 8);
+  }
+  for ( ; sz >= 4; sz -= 4, adr += 4) {      // One 32-bit Read per 4 Bytes
+    crc ^= M32(adr);
+    crc  = crc_tab[crc & 0xFF] ^ (crc >> 8);
+    crc  = crc_tab[crc & 0xFF] ^ (crc >> 8);
+    crc  = crc_tab[crc & 0xFF] ^ (crc >> 8);
+    crc  = crc_tab[crc & 0xFF] ^ (crc >> 8);
+  }
+  for ( ; sz; sz--, adr++) {                 // Trailing Bytes
+    crc = crc_tab[(crc ^ M8(adr)) & 0xFF] ^ (crc >> 8);
+  }
+  return (crc ^ 0xFFFFFFFF);
+}
+
+
+/*
+ *  Run a Command Queue (FlashQueue.H)
+ *    Parameter:      cmd:  List of Operations
+ *                    n:    Number of Operations
+ *                    buf:  Program Data (CQ_PROGRAM: buf + ofs)
+ *                    len:  Size of buf (in bytes)
+ *                    stat: Status per Operation (CQ_OK, ...)
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+int RunQueue (struct fcmd *cmd, unsigned long n, unsigned char *buf,
+              unsigned long len, unsigned long *stat) {
+  unsigned long i, w;
+  int r, err = 0, stop = 0;
+
+  for (i = 0; i < n; i++, cmd++) {
+    if (stop) {
+      stat[i] = CQ_SKIPPED;
+      continue;
+    }
+    switch (cmd->op) {
+      case CQ_ERASE:
+        r = stop = EraseSector(cmd->adr);
+        break;
+      case CQ_PROGRAM:
+        w = len & ~(bus - 1);                // whole Bus Words in buf
+        if ((cmd->ofs & (bus - 1)) || (cmd->ofs > w) || (cmd->sz > w - cmd->ofs)) {
+          stat[i] = CQ_BADARG;               // Data outside buf or unaligned
+          err = stop = 1;
+          continue;
+        }
+        r = stop = ProgramPage(cmd->adr, cmd->sz, buf + cmd->ofs);
+        break;
+      case CQ_BLANK:
+        r = BlankCheck(cmd->adr, cmd->sz, 0xFF);
+        cmd->res = r ? fail_adr : 0;
+        break;
+      case CQ_CRC:
+        cmd->res = Crc32(cmd->adr, cmd->sz);
+        r = 0;
+        break;
+      default:
+        stat[i] = CQ_BADOP;
+        err = 1;
+        continue;
+    }
+    stat[i] = r ? CQ_FAILED : CQ_OK;
+    if (r) err = 1;
+  }
+  return (err);
+}
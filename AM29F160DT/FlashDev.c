@@ -7,7 +7,7 @@
 /*                                                                     */
 /***********************************************************************/
 
-#include "..\FlashOS.H"        // FlashOS Structures
+#include "../FlashOS.H"        // FlashOS Structures
 
 
 struct FlashDevice const FlashDevice  =  {
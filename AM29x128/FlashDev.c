@@ -5,9 +5,14 @@
 /*                                                                     */
 /*  FlashDev.C:  Device Description for AM29x128 (16-bit Bus)          */
 /*                                                                     */
+/*  Targets:    AM29x128 (ARM7TDMI): ProgramPage only, ARM7 has no     */
+/*              Memory Access while the Core runs, so the Build has    */
+/*              no ProgramPages (Double Buffer)                        */
+/*              AM29x128 Cortex-M: also ProgramPages (FlashDblBuf.H)   */
+/*                                                                     */
 /***********************************************************************/
 
-#include "..\FlashOS.H"        // FlashOS Structures
+#include "../FlashOS.H"        // FlashOS Structures
 
 
 struct FlashDevice const FlashDevice  =  {
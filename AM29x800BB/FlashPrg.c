@@ -8,14 +8,24 @@
 /*                                                                     */
 /***********************************************************************/
 
-#include "..\FlashOS.H"        // FlashOS Structures
+#include "../FlashOS.H"        // FlashOS Structures
+#include "../FlashQueue.H"     // Command Queue (RunQueue)
 
+#ifndef FLASH_SIM              // Host Simulator: Accesses to Flash Model
 #define M8(adr)  (*((volatile unsigned char  *) (adr)))
 #define M16(adr) (*((volatile unsigned short *) (adr)))
 #define M32(adr) (*((volatile unsigned long  *) (adr)))
+#endif
 
 #define STACK_SIZE   64        // Stack Size
 
+#define UNLOCK_BYPASS 1        // Unlock Bypass Programming (0 - Disabled)
+#define SKIP_EMPTY    1        // Skip Words equal to Erased Value (0 - Disabled)
+#define ERASE_SKIP    1        // Skip Erase of blank Sectors (0 - Disabled)
+#define POLL_DQ7      1        // Program: DQ7 Data Polling (0 - DQ6 Toggle Bit)
+#define ERASE_AHEAD   1        // RunQueue: Erase in Background (0 - Disabled)
+#define SECTOR_MAX    0x10000  // Largest Sector Size, Boot Sectors lie within
+
 
 union fsreg {                  // Flash Status Register
   struct b  {
@@ -32,6 +42,16 @@ union fsreg {                  // Flash Status Register
 } fsr;
 
 unsigned long base_adr;
+unsigned long ub_active;       // Unlock Bypass Mode entered
+unsigned long ub_session;      // Keep Unlock Bypass until UnInit
+unsigned long skip_cnt;        // Number of skipped erased Words
+unsigned long fail_adr;        // First Address failing Blank Check
+unsigned long erase_skip;      // Number of skipped Sector Erases
+unsigned long crc_tab[256];    // CRC32 Lookup Table
+unsigned long ea_adr;          // Background Erase: Sector Address
+unsigned long ea_run;          // Background Erase: 1 - Running, 2 - Suspended
+unsigned long ea_pend;         // Background Erase: Result not collected
+unsigned long ea_fail;         // Background Erase failed
 
 
 /*
@@ -59,6 +79,128 @@ int Polling (unsigned long adr) {
 }
 
 
+/*
+ * Check if Program completed
+ *    Parameter:      adr:  Program Address
+ *                    dat:  Programmed Data
+ *    Return Value:   0 - OK,  1 - Failed
+ *
+ *  Uses DQ7 Data Polling (one Read per Iteration) when POLL_DQ7 is set,
+ *  otherwise the DQ6 Toggle Bit Algorithm as for Erase.
+ */
+
+int PollingProg (unsigned long adr, unsigned int dat) {
+  unsigned int q7;
+
+  if (!POLL_DQ7) return (Polling(adr));
+
+  q7 = (dat >> 7) & 1;
+  do {
+    fsr.v = M16(adr);
+    if (fsr.b.q7 == q7) return (0);  // Done
+  } while (fsr.b.q5 == 0);           // Check for Timeout
+  fsr.v = M16(adr);
+  if (fsr.b.q7 == q7) return (0);    // Done
+  M16(adr) = 0xF0;                   // Reset Device
+  return (1);                        // Failed
+}
+
+
+/*
+ *  Enter Unlock Bypass Mode
+ */
+
+void BypassEnter (void) {
+  M16(base_adr + 0xAAA) = 0xAA;
+  M16(base_adr + 0x554) = 0x55;
+  M16(base_adr + 0xAAA) = 0x20;
+  ub_active = 1;
+}
+
+
+/*
+ *  Exit Unlock Bypass Mode
+ */
+
+void BypassExit (void) {
+  if (ub_active) {
+    M16(base_adr) = 0x90;            // Unlock Bypass Reset
+    M16(base_adr) = 0x00;
+    ub_active = 0;
+  }
+}
+
+
+/*
+ *  Check if a Range reaches into the pending Background Erase
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes)
+ *    Return Value:   1 - Yes,  0 - No or no Erase pending
+ *
+ *  Compares SECTOR_MAX Ranges: Boot Sectors are not told apart.
+ */
+
+int EraseRange (unsigned long adr, unsigned long sz) {
+  unsigned long s;
+
+  if (!ea_pend) return (0);
+  s = base_adr + ((ea_adr - base_adr) & ~(SECTOR_MAX - 1));
+  return ((adr < s + SECTOR_MAX) && (adr + sz > s));
+}
+
+
+/*
+ *  Suspend the Background Erase to program another Sector
+ *
+ *  Waits for the Suspend Latency (DQ6 stops toggling), then DQ2 tells
+ *  a suspended Erase (DQ2 toggles) from one completed meanwhile.
+ */
+
+void EraseSuspend (void) {
+  unsigned int q6, q2;
+
+  M16(ea_adr) = 0xB0;          // Erase Suspend
+  do {
+    fsr.v = M16(ea_adr);
+    q6 = fsr.b.q6;
+    q2 = fsr.b.q2;
+    fsr.v = M16(ea_adr);
+    if ((fsr.b.q6 != q6) && fsr.b.q5) {  // Erase timed out
+      ea_run  = 0;
+      ea_fail = Polling(ea_adr);
+      return;
+    }
+  } while (fsr.b.q6 != q6);    // Wait for Suspend Latency
+  ea_run = (fsr.b.q2 != q2) ? 2 : 0;
+}
+
+
+/*
+ *  Resume the suspended Background Erase
+ */
+
+void EraseResume (void) {
+  M16(ea_adr) = 0x30;          // Erase Resume
+  ea_run = 1;
+}
+
+
+/*
+ *  Wait until the Background Erase completed
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+int EraseWait (void) {
+
+  if (ea_run == 2) EraseResume();
+  if (ea_run == 1) {
+    ea_run  = 0;
+    ea_fail = Polling(ea_adr);
+  }
+  return (ea_fail);
+}
+
+
 /*
  *  Initialize Flash Programming Functions
  *    Parameter:      adr:  Device Base Address
@@ -68,7 +210,13 @@ int Polling (unsigned long adr) {
  */
 
 int Init (unsigned long adr, unsigned long clk, unsigned long fnc) {
-  base_adr = adr;
+  base_adr   = adr;
+  ub_active  = 0;
+  ub_session = (fnc == 2);     // Program: stay in Unlock Bypass for Session
+  skip_cnt   = 0;
+  erase_skip = 0;
+  ea_run     = 0;
+  ea_pend    = 0;
   return (0);
 }
 
@@ -80,10 +228,65 @@ int Init (unsigned long adr, unsigned long clk, unsigned long fnc) {
  */
 
 int UnInit (unsigned long fnc) {
+  int err = 0;
+
+  if (ea_pend) {               // Background Erase not collected
+    ea_pend = 0;
+    err = EraseWait();
+  }
+  BypassExit();
+  return (err);
+}
+
+
+/*
+ *  Blank Check Checks if Memory is Blank
+ *    Parameter:      adr:  Block Start Address
+ *                    sz:   Block Size (in bytes)
+ *                    pat:  Block Pattern
+ *    Return Value:   0 - OK,  1 - Failed (fail_adr: first failing Address)
+ */
+
+int BlankCheck (unsigned long adr, unsigned long sz, unsigned char pat) {
+  unsigned short v;
+
+  EraseWait();                 // Complete Background Erase
+  BypassExit();
+
+  v = pat | (pat << 8);
+  for ( ; sz >= 2; sz -= 2, adr += 2) {
+    if (M16(adr) != v) break;   // Mismatch: locate Byte below
+  }
+  for ( ; sz; sz--, adr++) {
+    if (M8(adr) != pat) {
+      fail_adr = adr;
+      return (1);
+    }
+  }
   return (0);
 }
 
 
+/*
+ *  Fast Blank Scan of a Sector using 32-bit Reads
+ *    Parameter:      adr:  Sector Address
+ *    Return Value:   1 - Blank,  0 - Not Blank
+ *
+ *  Scans up to the next SECTOR_MAX Boundary: this is the whole Sector,
+ *  for a Boot Sector it includes the following Boot Sectors as well.
+ */
+
+int SectorBlank (unsigned long adr) {
+  unsigned long end;
+
+  end = base_adr + (((adr - base_adr) | (SECTOR_MAX - 1)) + 1);
+  for ( ; adr < end; adr += 4) {
+    if (M32(adr) != 0xFFFFFFFF) return (0);
+  }
+  return (1);
+}
+
+
 /*
  *  Erase complete Flash Memory
  *    Return Value:   0 - OK,  1 - Failed
@@ -91,6 +294,9 @@ int UnInit (unsigned long fnc) {
 
 int EraseChip (void) {
 
+  EraseWait();                 // Complete Background Erase
+  BypassExit();
+
   // Start Chip Erase Command
   M16(base_adr + 0xAAA) = 0xAA;
   M16(base_adr + 0x554) = 0x55;
@@ -104,12 +310,11 @@ int EraseChip (void) {
 
 
 /*
- *  Erase Sector in Flash Memory
+ *  Start Sector Erase, returns when the Erase is running
  *    Parameter:      adr:  Sector Address
- *    Return Value:   0 - OK,  1 - Failed
  */
 
-int EraseSector (unsigned long adr) {
+void EraseStart (unsigned long adr) {
 
   // Start Erase Sector Command
   M16(base_adr + 0xAAA) = 0xAA;
@@ -122,11 +327,117 @@ int EraseSector (unsigned long adr) {
   do {
     fsr.v = M16(adr);
   } while (fsr.b.q3 == 0);     // Wait for Sector Erase Timeout
+}
+
+
+/*
+ *  Erase Sector in Flash Memory
+ *    Parameter:      adr:  Sector Address
+ *    Return Value:   0 - OK,  1 - Failed
+ *
+ *  For the Sector of a pending Background Erase: its Result.
+ */
+
+int EraseSector (unsigned long adr) {
 
+  if (ea_pend && (adr == ea_adr)) {
+    ea_pend = 0;
+    return (EraseWait());
+  }
+  EraseWait();                 // Complete Background Erase
+  BypassExit();
+
+  if (ERASE_SKIP && SectorBlank(adr)) {
+    erase_skip++;              // Already erased
+    return (0);
+  }
+
+  EraseStart(adr);
   return (Polling(adr));       // Wait until Erase completed
 }
 
 
+/*
+ *  Erase Sectors in Flash Memory using one Erase Operation
+ *    Parameter:      adr:  List of Sector Addresses
+ *                    n:    Number of Sectors
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+int EraseSectors (unsigned long *adr, unsigned long n) {
+  unsigned long i;
+
+  EraseWait();                 // Complete Background Erase
+  BypassExit();
+
+  while (n) {
+    // Start Erase Sector Command
+    M16(base_adr + 0xAAA) = 0xAA;
+    M16(base_adr + 0x554) = 0x55;
+    M16(base_adr + 0xAAA) = 0x80;
+    M16(base_adr + 0xAAA) = 0xAA;
+    M16(base_adr + 0x554) = 0x55;
+    M16(adr[0]) = 0x30;
+
+    // Add Sectors while the Sector Erase Timeout is running
+    for (i = 1; i < n; i++) {
+      fsr.v = M16(adr[0]);
+      if (fsr.b.q3) break;     // Erase already started
+      M16(adr[i]) = 0x30;
+      fsr.v = M16(adr[0]);
+      if (fsr.b.q3) break;     // Sector may be rejected
+    }
+
+    do {
+      fsr.v = M16(adr[0]);
+    } while (fsr.b.q3 == 0);   // Wait for Sector Erase Timeout
+
+    if (Polling(adr[0]) != 0) {  // Wait until Erase completed
+      return (1);
+    }
+    adr += i;                  // Sectors not accepted go
+    n   -= i;                  // into the next Operation
+  }
+  return (0);
+}
+
+
+/*
+ *  Start a queued Erase in the Background
+ *    Parameter:      cmd:  Erase Entry
+ *                    n:    Number of Entries from cmd on
+ *    Return Value:   1 - Started (CQ_PENDING),  0 - Erase it now
+ *
+ *  Only Program Entries outside the Sector may follow, they program
+ *  with the Erase suspended. The Erase goes on after RunQueue returned,
+ *  while the Host loads the next Pages.
+ */
+
+int EraseAhead (struct fcmd *cmd, unsigned long n) {
+  unsigned long i;
+
+  if (ea_pend) return (0);     // one Background Erase at a Time
+  ea_adr  = cmd->adr;
+  ea_pend = 1;
+  for (i = 1; i < n; i++) {
+    if ((cmd[i].op != CQ_PROGRAM) || EraseRange(cmd[i].adr, cmd[i].sz)) {
+      ea_pend = 0;
+      return (0);
+    }
+  }
+
+  BypassExit();
+  ea_fail = 0;
+  if (ERASE_SKIP && SectorBlank(ea_adr)) {
+    erase_skip++;              // Already erased
+    return (1);
+  }
+  EraseStart(ea_adr);
+  ea_run = 1;
+  return (1);
+}
+
+
 /*
  *  Program Page in Flash Memory
  *    Parameter:      adr:  Page Start Address
@@ -136,17 +447,172 @@ int EraseSector (unsigned long adr) {
  */
 
 int ProgramPage (unsigned long adr, unsigned long sz, unsigned char *buf) {
-  int i;
+  unsigned long i;
 
+  if (EraseRange(adr, sz)) {   // Sector still erasing
+    if (EraseWait() != 0) return (1);
+  }
+  if (UNLOCK_BYPASS && !ub_active && !ea_run) {
+    BypassEnter();             // not while an Erase is running
+  }
   for (i = 0; i < ((sz+1)/2); i++)  {
-    // Start Program Command
-    M16(base_adr + 0xAAA) = 0xAA;
-    M16(base_adr + 0x554) = 0x55;
-    M16(base_adr + 0xAAA) = 0xA0;
-    M16(adr) = *((unsigned short *) buf);
-    if (Polling(adr) != 0) return (1);
+    if (SKIP_EMPTY && (*((unsigned short *) buf) == 0xFFFF)) {
+      skip_cnt++;              // Erased Value: nothing to program
+    } else {
+      if (ea_run == 1) EraseSuspend();
+      // Start Program Command
+      if (ub_active) {
+        M16(base_adr) = 0xA0;  // Unlock Bypass Program
+      } else {
+        M16(base_adr + 0xAAA) = 0xAA;
+        M16(base_adr + 0x554) = 0x55;
+        M16(base_adr + 0xAAA) = 0xA0;
+      }
+      M16(adr) = *((unsigned short *) buf);
+      if (PollingProg(adr, *((unsigned short *) buf)) != 0) {
+        BypassExit();
+        return (1);
+      }
+    }
     buf += 2;
     adr += 2;
   }
+  if (!ub_session) BypassExit();
+  if (ea_run == 2) EraseResume();
   return (0);
 }
+
+
+/*
+ *  Verify Flash Contents
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes)
+ *                    buf:  Data
+ *    Return Value:   (adr+sz) - OK, Failed Address
+ */
+
+unsigned long Verify (unsigned long adr, unsigned long sz, unsigned char *buf) {
+
+  EraseWait();                 // Complete Background Erase
+  BypassExit();
+
+  for ( ; sz >= 2; sz -= 2, adr += 2, buf += 2) {
+    if (M16(adr) != *((unsigned short *) buf)) break;
+  }
+  for ( ; sz; sz--, adr++, buf++) {
+    if (M8(adr) != *buf) break;
+  }
+  return (adr);
+}
+
+
+/*
+ *  Build CRC32 Lookup Table (reflected Polynomial 0xEDB88320)
+ */
+
+void CrcInit (void) {
+  unsigned long c;
+  int i, j;
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (j = 0; j < 8; j++) {
+      c = (c & 1) ? ((c >> 1) ^ 0xEDB88320) : (c >> 1);
+    }
+    crc_tab[i] = c;
+  }
+}
+
+
+/*
+ *  Calculate CRC32 of Flash Contents (same as zlib crc32)
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes)
+ *    Return Value:   CRC32 Value
+ */
+
+unsigned long Crc32 (unsigned long adr, unsigned long sz) {
+  unsigned long crc;
+
+  if (crc_tab[255] != 0x2D02EF8D) {  // Table not built yet
+    CrcInit();
+  }
+  EraseWait();                 // Complete Background Erase
+  BypassExit();
+
+  crc = 0xFFFFFFFF;
+  for ( ; sz && (adr & 3); sz--, adr++) {    // Leading Bytes
+    crc = crc_tab[(crc ^ M8(adr)) & 0xFF] ^ (crc >> 8);
+  }
+  for ( ; sz >= 4; sz -= 4, adr += 4) {      // One 32-bit Read per 4 Bytes
+    crc ^= M32(adr);
+    crc  = crc_tab[crc & 0xFF] ^ (crc >> 8);
+    crc  = crc_tab[crc & 0xFF] ^ (crc >> 8);
+    crc  = crc_tab[crc & 0xFF] ^ (crc >> 8);
+    crc  = crc_tab[crc & 0xFF] ^ (crc >> 8);
+  }
+  for ( ; sz; sz--, adr++) {                 // Trailing Bytes
+    crc = crc_tab[(crc ^ M8(adr)) & 0xFF] ^ (crc >> 8);
+  }
+  return (crc ^ 0xFFFFFFFF);
+}
+
+
+/*
+ *  Run a Command Queue (FlashQueue.H)
+ *    Parameter:      cmd:  List of Operations
+ *                    n:    Number of Operations
+ *                    buf:  Program Data (CQ_PROGRAM: buf + ofs)
+ *                    len:  Size of buf (in bytes)
+ *                    stat: Status per Operation (CQ_OK, ...)
+ *    Return Value:   0 - OK,  1 - Failed
+ *
+ *  With ERASE_AHEAD an Erase followed by Program Entries only runs in
+ *  the Background (CQ_PENDING) and overlaps the Host Download.
+ */
+
+int RunQueue (struct fcmd *cmd, unsigned long n, unsigned char *buf,
+              unsigned long len, unsigned long *stat) {
+  unsigned long i, w;
+  int r, err = 0, stop = 0;
+
+  for (i = 0; i < n; i++, cmd++) {
+    if (stop) {
+      stat[i] = CQ_SKIPPED;
+      continue;
+    }
+    switch (cmd->op) {
+      case CQ_ERASE:
+        if (ERASE_AHEAD && EraseAhead(cmd, n - i)) {
+          stat[i] = CQ_PENDING;  // Queue it again for the Result
+          continue;
+        }
+        r = stop = EraseSector(cmd->adr);
+        break;
+      case CQ_PROGRAM:
+        w = len & ~1;                        // whole Bus Words in buf
+        if ((cmd->ofs & 1) || (cmd->ofs > w) || (cmd->sz > w - cmd->ofs)) {
+          stat[i] = CQ_BADARG;               // Data outside buf or unaligned
+          err = stop = 1;
+          continue;
+        }
+        r = stop = ProgramPage(cmd->adr, cmd->sz, buf + cmd->ofs);
+        break;
+      case CQ_BLANK:
+        r = BlankCheck(cmd->adr, cmd->sz, 0xFF);
+        cmd->res = r ? fail_adr : 0;
+        break;
+      case CQ_CRC:
+        cmd->res = Crc32(cmd->adr, cmd->sz);
+        r = 0;
+        break;
+      default:
+        stat[i] = CQ_BADOP;
+        err = 1;
+        continue;
+    }
+    stat[i] = r ? CQ_FAILED : CQ_OK;
+    if (r) err = 1;
+  }
+  return (err);
+}
@@ -0,0 +1,96 @@
+/***********************************************************************/
+/*                                                                     */
+/*  Crc32.C:  Host Reference for the on-target Crc32 Function          */
+/*            of the Flash Programming Algorithms                      */
+/*                                                                     */
+/*  Computes the same CRC32 (IEEE 802.3, as zlib crc32) over a region  */
+/*  of a binary image, so a flashed region is verified by comparing    */
+/*  the 4-byte result of Crc32(adr, sz) on the target.                 */
+/*                                                                     */
+/*  Build:    cc -O2 -o crc32 Crc32.c                                  */
+/*  Usage:    crc32 image.bin [offset [size]]                          */
+/*                                                                     */
+/***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static unsigned int crc_tab[256];
+
+
+/*
+ *  Build CRC32 Lookup Table (reflected Polynomial 0xEDB88320)
+ */
+
+static void CrcInit (void) {
+  unsigned int c;
+  int i, j;
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (j = 0; j < 8; j++) {
+      c = (c & 1) ? ((c >> 1) ^ 0xEDB88320) : (c >> 1);
+    }
+    crc_tab[i] = c;
+  }
+}
+
+
+/*
+ *  Update CRC32 with a Block of Data
+ *    Parameter:      crc:  Current CRC (0xFFFFFFFF at Start)
+ *                    buf:  Data
+ *                    sz:   Size (in bytes)
+ *    Return Value:   Updated CRC
+ */
+
+static unsigned int CrcUpdate (unsigned int crc, const unsigned char *buf, size_t sz) {
+
+  while (sz--) {
+    crc = crc_tab[(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+  }
+  return (crc);
+}
+
+
+int main (int argc, char **argv) {
+  unsigned char buf[4096];
+  unsigned long ofs, sz;
+  unsigned int  crc;
+  size_t        n;
+  FILE         *f;
+
+  if ((argc < 2) || (argc > 4)) {
+    fprintf(stderr, "usage: %s image.bin [offset [size]]\n", argv[0]);
+    return (2);
+  }
+  f = fopen(argv[1], "rb");
+  if (f == NULL) {
+    perror(argv[1]);
+    return (2);
+  }
+  ofs = (argc > 2) ? strtoul(argv[2], NULL, 0) : 0;
+  sz  = (argc > 3) ? strtoul(argv[3], NULL, 0) : (unsigned long) -1;
+  if (fseek(f, (long) ofs, SEEK_SET) != 0) {
+    perror(argv[1]);
+    return (2);
+  }
+
+  CrcInit();
+  crc = 0xFFFFFFFF;
+  while (sz) {
+    n = (sz < sizeof(buf)) ? sz : sizeof(buf);
+    n = fread(buf, 1, n, f);
+    if (n == 0) break;
+    crc = CrcUpdate(crc, buf, n);
+    sz -= n;
+  }
+  fclose(f);
+  if ((argc > 3) && sz) {
+    fprintf(stderr, "%s: image shorter than offset + size\n", argv[1]);
+    return (1);
+  }
+
+  printf("0x%08X\n", crc ^ 0xFFFFFFFF);
+  return (0);
+}
@@ -0,0 +1,565 @@
+/***********************************************************************/
+/*                                                                     */
+/*  FlashSim.CPP:  AMD Command Set NOR Flash Simulator (Host Build)    */
+/*                                                                     */
+/*  Models one Device on an 8-bit or 16-bit Bus or two interleaved     */
+/*  16-bit Devices on a 32-bit Bus:                                    */
+/*    - Unlock Cycles (AA/55), Program (A0), Unlock Bypass (20/90/00), */
+/*      Sector/Chip Erase (80/30/10) with Sector Erase Timeout Window, */
+/*      Erase Suspend/Resume (B0/30), Write Buffer (25/29), CFI (98)   */
+/*    - Status: DQ7 Data Polling, DQ6/DQ2 Toggle, DQ5 Timeout when a   */
+/*      0 is programmed to 1, DQ3 Erase Window, DQ1 Write Buffer Abort */
+/*    - Simulated Time: every Bus Access takes Timing.access, Program  */
+/*      and Erase take typical, max. or random Times in between        */
+/*                                                                     */
+/***********************************************************************/
+
+#include <string.h>
+#include <vector>
+#include "FlashSim.h"
+
+namespace Sim {
+
+Stats stats;
+
+static const uint64_t T_WINDOW  = 50000;     // Sector Erase Timeout (ns)
+static const uint64_t T_SUSPEND = 20000;     // Erase Suspend Latency (ns)
+
+enum { ER_NONE, ER_WINDOW, ER_RUN, ER_SUSPENDING, ER_SUSPENDED };
+enum { WB_NONE, WB_COUNT, WB_LOAD, WB_ABORT };
+
+static Timing   tm;
+static uint64_t now;                         // Simulated Time (ns)
+static uint32_t rnd;                         // Random State
+static int      bus;                         // Bus Width in Bytes
+static int      nchip;                       // Number of Devices
+static uint32_t base, dev_size;
+static bool     poll;                        // Status returned by Access
+static void   (*host)(void);                 // Host Side (Sim::Host)
+
+
+/*
+ *  Operation Time in ns: typical, max. or random in between
+ */
+
+static uint64_t Draw (uint32_t typ, uint32_t max, uint64_t unit) {
+  if (tm.mode == 1) return (max * unit);
+  if (tm.mode == 2) {
+    rnd = rnd * 1103515245 + 12345;
+    return ((typ + (rnd >> 8) % (max - typ + 1)) * unit);
+  }
+  return (typ * unit);
+}
+
+static int Log2Up (uint64_t v) {
+  int n;
+
+  for (n = 0; ((uint64_t) 1 << n) < v; n++);
+  return (n);
+}
+
+
+class Chip {
+public:
+  int       cw;                              // Data Width in Bytes (1, 2)
+  uint32_t  wb;                              // Write Buffer Size (Bytes)
+  std::vector<uint8_t>  mem;                 // Array
+  std::vector<uint32_t> sec_adr, sec_sz;     // Sectors (Byte Offsets)
+  std::vector<uint8_t>  erasing;             // Sectors selected for Erase
+  uint8_t   cfi_tab[0x60];
+
+  int       seq;                             // Unlock Sequence Position
+  bool      bypass, bypass_rst, cfi, prog_setup;
+  bool      t6, t2;                          // Toggle Bits
+
+  bool      busy, fail, timeout;             // Program running
+  uint64_t  p_end;
+  uint32_t  p_dat;                           // Last Data (DQ7)
+  std::vector<uint32_t> p_adr, p_val;        // Words to program
+
+  int       wb_state;
+  uint32_t  wb_sec, wb_cnt, wb_page;
+
+  int       er;
+  uint64_t  er_win, er_end, er_left, er_susp;
+
+  void Setup (int width, uint32_t size, int n, const uint32_t *adr,
+              const uint32_t *sz, uint32_t wbuf) {
+    int i;
+
+    cw = width;
+    wb = wbuf;
+    mem.assign(size, 0xFF);
+    sec_adr.assign(adr, adr + n);
+    sec_sz.assign(sz, sz + n);
+    erasing.assign(n, 0);
+    seq = 0;
+    bypass = bypass_rst = cfi = prog_setup = false;
+    t6 = t2 = false;
+    busy = fail = timeout = false;
+    wb_state = WB_NONE;
+    er = ER_NONE;
+    for (i = 0; i < n; i++) {
+      if (sec_adr[i] + sec_sz[i] > size) sec_sz[i] = size - sec_adr[i];
+    }
+    BuildCfi(size);
+  }
+
+  void BuildCfi (uint32_t size) {
+    std::vector<uint32_t> rn, rs;            // Regions: Blocks, Block Size
+    unsigned int i, j, e;
+    bool top;
+
+    memset(cfi_tab, 0, sizeof(cfi_tab));
+    for (i = 0; i < sec_sz.size(); i++) {
+      if (rs.size() && (rs.back() == sec_sz[i])) rn.back()++;
+      else { rn.push_back(1); rs.push_back(sec_sz[i]); }
+    }
+    top = (rs.size() > 1) && (rs.front() > rs.back());
+    cfi_tab[0x10] = 'Q'; cfi_tab[0x11] = 'R'; cfi_tab[0x12] = 'Y';
+    cfi_tab[0x13] = 0x02;                    // AMD Command Set
+    cfi_tab[0x15] = 0x40;                    // Primary Extended Query
+    cfi_tab[0x1B] = 0x27; cfi_tab[0x1C] = 0x36;
+    e = Log2Up(tm.prog_typ);
+    cfi_tab[0x1F] = e;
+    cfi_tab[0x23] = Log2Up(tm.prog_max) > (int) e ? Log2Up(tm.prog_max) - e : 1;
+    if (wb) {
+      e = Log2Up(tm.buf_typ);
+      cfi_tab[0x20] = e;
+      cfi_tab[0x24] = Log2Up(tm.buf_max) > (int) e ? Log2Up(tm.buf_max) - e : 1;
+    }
+    e = Log2Up(tm.erase_typ);
+    cfi_tab[0x21] = e;
+    cfi_tab[0x25] = Log2Up(tm.erase_max) > (int) e ? Log2Up(tm.erase_max) - e : 1;
+    e = Log2Up((uint64_t) tm.erase_typ * sec_sz.size());
+    cfi_tab[0x22] = e;
+    cfi_tab[0x26] = Log2Up((uint64_t) tm.erase_max * sec_sz.size()) > (int) e ?
+                    Log2Up((uint64_t) tm.erase_max * sec_sz.size()) - e : 1;
+    cfi_tab[0x27] = Log2Up(size);
+    cfi_tab[0x28] = (cw == 2) ? 0x02 : 0x00; // x16 or x8 Interface
+    cfi_tab[0x2A] = wb ? Log2Up(wb) : 0;
+    cfi_tab[0x2C] = rs.size() <= 4 ? rs.size() : 4;
+    for (i = 0; i < cfi_tab[0x2C]; i++) {
+      j = top ? (rs.size() - 1 - i) : i;     // Top Boot: listed reversed
+      cfi_tab[0x2D + 4*i] = (rn[j] - 1) & 0xFF;
+      cfi_tab[0x2E + 4*i] = (rn[j] - 1) >> 8;
+      cfi_tab[0x2F + 4*i] = (rs[j] >> 8) & 0xFF;
+      cfi_tab[0x30 + 4*i] = (rs[j] >> 16);
+    }
+    cfi_tab[0x40] = 'P'; cfi_tab[0x41] = 'R'; cfi_tab[0x42] = 'I';
+    cfi_tab[0x43] = '1'; cfi_tab[0x44] = '0';
+    cfi_tab[0x4F] = top ? 3 : 2;             // Top/Bottom Boot Flag
+  }
+
+  int SectorOf (uint32_t ofs) {
+    unsigned int i;
+
+    for (i = 0; i < sec_adr.size(); i++) {
+      if ((ofs >= sec_adr[i]) && (ofs - sec_adr[i] < sec_sz[i])) return (i);
+    }
+    return (-1);
+  }
+
+  uint32_t Array (uint32_t wa) {
+    uint32_t o = wa * cw;
+
+    if (o + cw > mem.size()) return ((cw == 2) ? 0xFFFF : 0xFF);
+    return ((cw == 2) ? (mem[o] | (mem[o + 1] << 8)) : mem[o]);
+  }
+
+  void EraseDone (void) {
+    unsigned int i;
+
+    for (i = 0; i < erasing.size(); i++) {
+      if (erasing[i]) memset(&mem[sec_adr[i]], 0xFF, sec_sz[i]);
+    }
+    erasing.assign(erasing.size(), 0);
+    er = ER_NONE;
+  }
+
+  uint64_t EraseTime (void) {
+    uint64_t t = 0;
+    unsigned int i;
+
+    for (i = 0; i < erasing.size(); i++) {
+      if (erasing[i]) {
+        t += Draw(tm.erase_typ, tm.erase_max, 1000000);
+        stats.sectors++;
+      }
+    }
+    return (t);
+  }
+
+  void Update (void) {
+    unsigned int i;
+    uint32_t     o;
+
+    if (busy && !timeout && (now >= p_end)) {
+      if (fail) {
+        timeout = true;                      // DQ5 until Reset
+        stats.fail++;
+      } else {
+        for (i = 0; i < p_adr.size(); i++) {
+          o = p_adr[i] * cw;
+          if (o + cw > mem.size()) continue;
+          mem[o] &= p_val[i];
+          if (cw == 2) mem[o + 1] &= p_val[i] >> 8;
+        }
+        busy = false;
+      }
+    }
+    if ((er == ER_WINDOW) && (now >= er_win)) {
+      er     = ER_RUN;
+      er_end = er_win + EraseTime();
+    }
+    if ((er == ER_SUSPENDING) && (now >= er_susp)) {
+      if (er_end <= er_susp) {
+        EraseDone();                         // Completed before Suspend
+      } else {
+        er      = ER_SUSPENDED;
+        er_left = er_end - er_susp;
+      }
+    }
+    if ((er == ER_RUN) && (now >= er_end)) EraseDone();
+  }
+
+  void Program (void) {                      // Start Program of p_adr/p_val
+    unsigned int i;
+    uint32_t     old;
+    uint64_t     t;
+
+    fail = false;
+    for (i = 0; i < p_adr.size(); i++) {
+      old = Array(p_adr[i]);
+      if ((old & p_val[i]) != p_val[i]) fail = true;   // 0 -> 1
+    }
+    if (p_adr.size() > 1) {
+      t = fail ? Draw(tm.buf_max, tm.buf_max, 1000) : Draw(tm.buf_typ, tm.buf_max, 1000);
+      stats.buf++;
+    } else {
+      t = fail ? Draw(tm.prog_max, tm.prog_max, 1000) : Draw(tm.prog_typ, tm.prog_max, 1000);
+      stats.prog++;
+    }
+    busy    = true;
+    timeout = false;
+    p_end   = now + t;
+  }
+
+  void WbWrite (uint32_t wa, uint32_t d) {
+    int s = SectorOf(wa * cw);
+
+    if (wb_state == WB_COUNT) {
+      wb_cnt = (d & 0xFFFF) + 1;
+      if ((s != (int) wb_sec) || (wb_cnt * cw > wb)) {
+        wb_state = WB_ABORT;
+        stats.fail++;
+        return;
+      }
+      p_adr.clear();
+      p_val.clear();
+      wb_state = WB_LOAD;
+      return;
+    }
+    if (p_adr.size() == wb_cnt) {            // All loaded: expect Confirm
+      wb_state = WB_NONE;
+      if (((d & 0xFF) == 0x29) && (s == (int) wb_sec)) {
+        Program();
+      } else {
+        wb_state = WB_ABORT;
+        stats.fail++;
+      }
+      return;
+    }
+    if (p_adr.size() == 0) wb_page = (wa * cw) / wb;
+    if ((s != (int) wb_sec) || ((wa * cw) / wb != wb_page)) {
+      wb_state = WB_ABORT;                   // Outside of Write Buffer Page
+      stats.fail++;
+      return;
+    }
+    p_adr.push_back(wa);
+    p_val.push_back(d);
+    p_dat = d;
+  }
+
+  void Write (uint32_t wa, uint32_t d) {
+    bool    u1 = ((wa & 0x7FF) == 0x555);
+    bool    u2 = ((wa & 0x7FF) == 0x2AA);
+    uint8_t c  = d & 0xFF;
+    int     s;
+
+    Update();
+    if (busy) {                              // Program running
+      if (timeout && (c == 0xF0)) {
+        busy = timeout = false;              // Reset after Timeout
+        seq  = 0;
+      }
+      return;
+    }
+    if (er == ER_WINDOW) {
+      s = SectorOf(wa * cw);
+      if ((c == 0x30) && (s >= 0)) {         // Additional Sector
+        erasing[s] = 1;
+        er_win = now + T_WINDOW;
+      } else if (c == 0xB0) {                // Suspend ends Window
+        er      = ER_SUSPENDING;
+        er_end  = now + EraseTime();
+        er_susp = now + T_SUSPEND;
+        stats.suspend++;
+      } else {                               // Other Command: Erase aborted
+        erasing.assign(erasing.size(), 0);
+        er  = ER_NONE;
+        seq = 0;
+      }
+      return;
+    }
+    if (er == ER_RUN) {
+      if (c == 0xB0) {
+        er      = ER_SUSPENDING;
+        er_susp = now + T_SUSPEND;
+        stats.suspend++;
+      }
+      return;
+    }
+    if (er == ER_SUSPENDING) return;
+
+    if ((wb_state == WB_COUNT) || (wb_state == WB_LOAD)) {
+      WbWrite(wa, d);
+      return;
+    }
+    if (wb_state == WB_ABORT) {              // Needs AA/55/F0
+      if      ((seq == 0) && (c == 0xAA) && u1) seq = 1;
+      else if ((seq == 1) && (c == 0x55) && u2) seq = 2;
+      else if ((seq == 2) && (c == 0xF0)) { seq = 0; wb_state = WB_NONE; }
+      else seq = 0;
+      return;
+    }
+    if (prog_setup) {                        // Program Data
+      prog_setup = false;
+      s = SectorOf(wa * cw);
+      if ((er == ER_SUSPENDED) && (s >= 0) && erasing[s]) return;
+      p_adr.assign(1, wa);
+      p_val.assign(1, d);
+      p_dat = d;
+      Program();
+      return;
+    }
+    if ((er == ER_SUSPENDED) && (c == 0x30) && (seq == 0)) {
+      er     = ER_RUN;                       // Erase Resume
+      er_end = now + er_left;
+      return;
+    }
+    if (bypass) {
+      if (c == 0xA0) prog_setup = true;
+      else if (c == 0x90) bypass_rst = true;
+      else if ((c == 0x00) && bypass_rst) bypass = bypass_rst = false;
+      else bypass_rst = false;
+      return;
+    }
+    if (c == 0xF0) {                         // Reset to Read
+      seq = 0;
+      cfi = false;
+      return;
+    }
+    if ((c == 0x98) && ((wa & 0x7FF) == 0x55) && (seq == 0)) {
+      cfi = true;                            // CFI Query
+      return;
+    }
+    switch (seq) {
+      case 0:
+        seq = ((c == 0xAA) && u1) ? 1 : 0;
+        break;
+      case 1:
+        seq = ((c == 0x55) && u2) ? 2 : 0;
+        break;
+      case 2:
+        seq = 0;
+        if ((c == 0xA0) && u1) {
+          prog_setup = true;
+        } else if ((c == 0x80) && u1 && (er == ER_NONE)) {
+          seq = 3;
+        } else if ((c == 0x20) && u1 && (er == ER_NONE)) {
+          bypass = true;
+        } else if ((c == 0x25) && wb && ((s = SectorOf(wa * cw)) >= 0)) {
+          wb_sec   = s;
+          wb_state = WB_COUNT;
+        }
+        break;
+      case 3:
+        seq = ((c == 0xAA) && u1) ? 4 : 0;
+        break;
+      case 4:
+        seq = ((c == 0x55) && u2) ? 5 : 0;
+        break;
+      case 5:
+        seq = 0;
+        if ((c == 0x10) && u1) {             // Chip Erase
+          erasing.assign(erasing.size(), 1);
+          er     = ER_RUN;
+          er_end = now + EraseTime();
+          stats.erase++;
+        } else if ((c == 0x30) && ((s = SectorOf(wa * cw)) >= 0)) {
+          erasing[s] = 1;                    // Sector Erase
+          er     = ER_WINDOW;
+          er_win = now + T_WINDOW;
+          stats.erase++;
+        }
+        break;
+    }
+  }
+
+  uint32_t Read (uint32_t wa) {
+    int s;
+
+    Update();
+    if (busy || (wb_state == WB_ABORT)) {
+      poll = true;
+      t6   = !t6;
+      return ((~p_dat & 0x80) | (t6 << 6) | (timeout ? 0x20 : 0) |
+              ((wb_state == WB_ABORT) ? 0x02 : 0));
+    }
+    if ((er == ER_WINDOW) || (er == ER_RUN) || (er == ER_SUSPENDING)) {
+      poll = true;
+      t6   = !t6;
+      s    = SectorOf(wa * cw);
+      if ((s >= 0) && erasing[s]) t2 = !t2;
+      return ((t6 << 6) | ((er != ER_WINDOW) ? 0x08 : 0) | (t2 << 2));
+    }
+    if (cfi) return ((wa < 0x60) ? cfi_tab[wa] : 0);
+    if (er == ER_SUSPENDED) {
+      s = SectorOf(wa * cw);
+      if ((s >= 0) && erasing[s]) {          // Erase-suspended Sector
+        poll = true;
+        t2   = !t2;
+        return (0x80 | (t6 << 6) | (t2 << 2));
+      }
+    }
+    return (Array(wa));
+  }
+};
+
+static Chip chip[2];
+
+
+void Setup (int width, uint32_t adr, uint32_t size,
+            int nsec, const uint32_t *sec_adr, const uint32_t *sec_sz,
+            uint32_t wb, const Timing &t) {
+  std::vector<uint32_t> a(sec_adr, sec_adr + nsec), s(sec_sz, sec_sz + nsec);
+  int i;
+
+  tm       = t;
+  rnd      = t.seed;
+  now      = 0;
+  bus      = width;
+  nchip    = (bus == 4) ? 2 : 1;
+  base     = adr;
+  dev_size = size;
+  for (i = 0; i < nsec; i++) {               // Sectors per Device
+    a[i] /= nchip;
+    s[i] /= nchip;
+  }
+  for (i = 0; i < nchip; i++) {
+    chip[i].Setup((bus == 1) ? 1 : 2, size / nchip, nsec, &a[0], &s[0], wb);
+  }
+  Clear();
+}
+
+
+/*
+ *  One Access of Bus Width: Beat Address in Bus Words
+ */
+
+static uint32_t BeatRead (uint32_t ba) {
+  now += tm.access;
+  stats.rd++;
+  if (bus == 4) return (chip[0].Read(ba) | (chip[1].Read(ba) << 16));
+  return (chip[0].Read(ba));
+}
+
+static void BeatWrite (uint32_t ba, uint32_t val, uint32_t lanes) {
+  now += tm.access;
+  stats.wr++;
+  if (bus == 4) {
+    if (lanes & 0x3) chip[0].Write(ba, val & 0xFFFF);
+    if (lanes & 0xC) chip[1].Write(ba, val >> 16);
+  } else {
+    chip[0].Write(ba, val);
+  }
+}
+
+
+uint32_t Read (uint32_t adr, int size) {
+  uint32_t ofs = adr - base, b, v, r = 0;
+  int      i;
+
+  poll = false;
+  for (b = ofs & ~(bus - 1); b < ofs + size; b += bus) {
+    v = BeatRead(b / bus);
+    for (i = 0; i < bus; i++) {              // Bytes within Access
+      if ((b + i >= ofs) && (b + i < ofs + size)) {
+        r |= ((v >> (8 * i)) & 0xFF) << (8 * (b + i - ofs));
+      }
+    }
+  }
+  if (poll) stats.polls++;
+  return (r);
+}
+
+void Write (uint32_t adr, uint32_t val, int size) {
+  uint32_t ofs = adr - base, b, v, lanes;
+  int      i;
+
+  for (b = ofs & ~(bus - 1); b < ofs + size; b += bus) {
+    v = lanes = 0;
+    for (i = 0; i < bus; i++) {
+      if ((b + i >= ofs) && (b + i < ofs + size)) {
+        v     |= ((val >> (8 * (b + i - ofs))) & 0xFF) << (8 * i);
+        lanes |= 1 << i;
+      }
+    }
+    BeatWrite(b / bus, v, lanes);
+  }
+}
+
+
+static uint8_t *Cell (uint32_t adr) {
+  uint32_t ofs = adr - base;
+
+  if (ofs >= dev_size) return (NULL);
+  if (bus == 4) return (&chip[(ofs >> 1) & 1].mem[(ofs >> 2) * 2 + (ofs & 1)]);
+  return (&chip[0].mem[ofs]);
+}
+
+uint8_t Peek (uint32_t adr) {
+  uint8_t *p = Cell(adr);
+
+  return (p ? *p : 0xFF);
+}
+
+void Poke (uint32_t adr, uint8_t val) {
+  uint8_t *p = Cell(adr);
+
+  if (p) *p = val;
+}
+
+uint64_t Now (void) {
+  return (now);
+}
+
+void Idle (uint64_t ns) {                    // e.g. Host Download
+  now += ns;
+}
+
+void Host (void (*fn)(void)) {
+  host = fn;
+}
+
+void Ram (void) {                            // e.g. Double Buffer State
+  now += tm.access;
+  if (host) host();
+}
+
+void Clear (void) {
+  memset(&stats, 0, sizeof(stats));
+}
+
+}
@@ -0,0 +1,92 @@
+/***********************************************************************/
+/*                                                                     */
+/*  FlashSim.H:  AMD Command Set NOR Flash Simulator (Host Build)      */
+/*                                                                     */
+/*  M8/M16/M32 of the Flash Programming Algorithms are routed through  */
+/*  SimBus Proxies into the Model: a Read or Write of the Proxy is one */
+/*  Bus Access of the simulated Target.                                */
+/*                                                                     */
+/*  The Double Buffer Words (DB_WORD) are SimMbx Proxies: each Target  */
+/*  Access takes one Access Time and runs the Host Side attached with  */
+/*  Sim::Host, which fills the Buffers meanwhile (ProgramPages).       */
+/*                                                                     */
+/***********************************************************************/
+
+#ifndef __FLASHSIM_H
+#define __FLASHSIM_H
+
+#include <stdint.h>
+
+namespace Sim {
+
+  struct Timing {              // Operation Times, drawn per Operation
+    uint32_t prog_typ;         // Word Program typical (us)
+    uint32_t prog_max;         // Word Program max. (us)
+    uint32_t buf_typ;          // Write Buffer Program typical (us)
+    uint32_t buf_max;          // Write Buffer Program max. (us)
+    uint32_t erase_typ;        // Sector Erase typical (ms)
+    uint32_t erase_max;        // Sector Erase max. (ms)
+    int      mode;             // 0 - typical, 1 - max., 2 - random
+    uint32_t seed;             // Seed for random Mode
+    uint32_t access;           // Bus Access Time (ns)
+  };
+
+  struct Stats {               // Counters since Setup or last Clear
+    uint64_t rd;               // Bus Reads  (Accesses of Bus Width)
+    uint64_t wr;               // Bus Writes (Accesses of Bus Width)
+    uint64_t polls;            // Reads returning Status
+    uint64_t prog;             // Word Program Operations
+    uint64_t buf;              // Write Buffer Program Operations
+    uint64_t erase;            // Erase Operations (Sector or Chip)
+    uint64_t sectors;          // Sectors erased
+    uint64_t suspend;          // Erase Suspends
+    uint64_t fail;             // Operations failed (DQ5 / Abort)
+  };
+
+  extern Stats stats;
+
+  // Set up Device: bus - Bus Width in Bytes (1, 2, 4 - 2x 16-bit Devices),
+  // Sector Table in Bus Addresses relative to base, wb - Write Buffer
+  // Bytes per Device (0 - none)
+  void     Setup (int bus, uint32_t base, uint32_t size,
+                  int nsec, const uint32_t *sec_adr, const uint32_t *sec_sz,
+                  uint32_t wb, const Timing &t);
+  uint32_t Read  (uint32_t adr, int size);
+  void     Write (uint32_t adr, uint32_t val, int size);
+  uint8_t  Peek  (uint32_t adr);             // Array Content, no Bus Access
+  void     Poke  (uint32_t adr, uint8_t val);
+  uint64_t Now   (void);                     // Simulated Time (ns)
+  void     Idle  (uint64_t ns);              // Time without Bus Access
+  void     Host  (void (*fn)(void));         // Host Side, run on Target RAM Access
+  void     Ram   (void);                     // Target Access to Host shared RAM
+  void     Clear (void);                     // Clear Statistics
+}
+
+template <typename T> class SimBus {         // M8/M16/M32 Proxy
+  uint32_t adr;
+public:
+  explicit SimBus (uint32_t a) : adr(a) { }
+  operator T () const { return ((T) Sim::Read(adr, sizeof(T))); }
+  template <typename V>                      // any Integer: exact Match
+  const SimBus &operator= (V v) const { Sim::Write(adr, (T) v, sizeof(T)); return (*this); }
+  const SimBus &operator= (const SimBus &s) const { return (*this = (T) s); }  // Bus to Bus
+};
+
+#define M8(adr)  (SimBus<uint8_t> (adr))
+#define M16(adr) (SimBus<uint16_t>(adr))
+#define M32(adr) (SimBus<uint32_t>(adr))
+
+class SimMbx {                               // Target RAM Word written by Host
+  uint32_t v;
+  uint64_t t;                                // Time of last Target Write
+public:
+  operator uint32_t () { Sim::Ram(); return (v); }
+  SimMbx &operator= (uint32_t x) { v = x; t = Sim::Now(); Sim::Ram(); return (*this); }
+  uint32_t Get  (void) const { return (v); }   // Host Access: no Time
+  void     Set  (uint32_t x) { v = x; }
+  uint64_t Time (void) const { return (t); }
+};
+
+#define DB_WORD  SimMbx
+
+#endif
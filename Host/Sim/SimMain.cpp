@@ -0,0 +1,721 @@
+/***********************************************************************/
+/*                                                                     */
+/*  SimMain.CPP:  Runs a Flash Programming Algorithm on the Simulator  */
+/*                                                                     */
+/*  FlashPrg.c and FlashDev.c of an Algorithm are compiled natively    */
+/*  with FLASH_SIM and linked with the Flash Model. The Image is       */
+/*  erased, programmed and verified as the Debugger does it (Init /    */
+/*  Function / UnInit per Phase), then the Model Content, the Word     */
+/*  Programs and the Verify Reads are compared with the Image, and the */
+/*  simulated Time and Bus Transactions of each Phase are              */
+/*  shown, as Text or as one JSON Object (make bench collects them).   */
+/*                                                                     */
+/*  Usage:  sim-<algo> [options] [image.bin]                           */
+/*    -s size     Size of generated Image (default 64kB)               */
+/*    -g pattern  Generated Image: random, sparse (mostly 0xFF), zero  */
+/*                or boot (random over the Boot Sectors)               */
+/*    -o offset   Image Offset in Device                               */
+/*    -t mode     Times: typ, max or rand                              */
+/*    -p typ,max  Word Program Time (us)                               */
+/*    -q typ,max  Write Buffer Program Time (us), needed with -w       */
+/*    -e typ,max  Sector Erase Time (ms)                               */
+/*    -w bytes    Write Buffer Size per Device (0 - none)              */
+/*                Times default to AM29LV Word Programming, the        */
+/*                Makefile selects the Family per Algorithm (OPT_*)    */
+/*    -a ns       Bus Access Time                                      */
+/*    -b bits     Bus Width (8, 16, 32) instead of FlashDevice         */
+/*    -L layout   Sectors instead of FlashDevice, e.g. 8x8K,31x64K     */
+/*    -c          Erase Chip instead of Sectors                        */
+/*    -m          Erase and Program in one Session                     */
+/*    -Q          Erase and Program through the Command Queue          */
+/*                (RunQueue, one Call per Phase, CRC32 checked), with  */
+/*                -m one Call per Sector: its Pages and the Erase of   */
+/*                the next Sector, which may run on in the Background; */
+/*                malformed Program Entries must fail as CQ_BADARG     */
+/*    -A          Check that -Q -m suspended a Background Erase        */
+/*    -D          Program through ProgramPages (Double Buffer): the    */
+/*                Host fills one Buffer while the other is programmed  */
+/*    -x kB/s     Host Download Rate of the Page Data (0 - no Time)    */
+/*    -f          Device initially erased (default: random Content)    */
+/*    -j          Results as JSON                                      */
+/*                                                                     */
+/***********************************************************************/
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "../FlashOS.H"
+#include "../../FlashQueue.H"
+#include "../../FlashDblBuf.H"
+
+
+static std::vector<uint32_t> sec_adr, sec_sz;
+static std::vector<uint8_t>  img, old;
+static uint32_t rnd = 1;
+static uint32_t base;                        // Device Address (FlashDevice)
+
+static std::vector<struct fcmd> queue;
+static uint32_t                 xfer;        // Download Rate (kB/s)
+
+
+static uint8_t Random (void) {
+  rnd = rnd * 1103515245 + 12345;
+  return (rnd >> 16);
+}
+
+static void Range (const char *s, uint32_t *typ, uint32_t *max) {
+  *typ = strtoul(s, (char **) &s, 0);
+  *max = (*s == ',') ? strtoul(s + 1, NULL, 0) : *typ;
+  if (*max < *typ) *max = *typ;
+}
+
+static uint32_t Size (const char *s) {
+  char     *e;
+  uint32_t  n = strtoul(s, &e, 0);
+
+  if ((*e == 'k') || (*e == 'K')) n <<= 10;
+  if ((*e == 'm') || (*e == 'M')) n <<= 20;
+  return (n);
+}
+
+
+/*
+ *  Sector Table from FlashDevice or from Layout String (n x Size, ...)
+ */
+
+static uint32_t Layout (const char *s) {
+  uint32_t adr = 0, n, sz;
+
+  sec_adr.clear();
+  sec_sz.clear();
+  if (s == NULL) {
+    const struct FlashSectors *p = FlashDevice.sectors;
+    for (; p->szSector != 0xFFFFFFFF; p++) {
+      for (adr = p->AddrSector; ; adr += p->szSector) {
+        if (p[1].szSector != 0xFFFFFFFF) {
+          if (adr >= p[1].AddrSector) break;
+        } else {
+          if (adr >= FlashDevice.szDev) break;
+        }
+        sec_adr.push_back(adr);
+        sec_sz.push_back(p->szSector);
+      }
+    }
+    return (FlashDevice.szDev);
+  }
+  while (*s) {
+    n = strtoul(s, (char **) &s, 0);
+    if (*s++ != 'x') return (0);
+    sz = Size(s);
+    while (*s && (*s != ',')) s++;
+    if (*s == ',') s++;
+    while (n--) {
+      sec_adr.push_back(adr);
+      sec_sz.push_back(sz);
+      adr += sz;
+    }
+  }
+  return (adr);
+}
+
+
+/*
+ *  Host Download of Page Data: Time while the Target waits
+ */
+
+static uint64_t Xfer (uint32_t bytes) {
+  return (xfer ? ((uint64_t) bytes * 1000000000 / ((uint64_t) xfer * 1024)) : 0);
+}
+
+static void Load (uint32_t bytes) {
+  Sim::Idle(Xfer(bytes));
+}
+
+
+/*
+ *  Erase the Sectors overlapping [adr, adr + sz) not erased yet
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+static std::vector<uint8_t> done;
+static uint32_t             slow;
+
+static int Erase (uint32_t base, uint32_t adr, uint32_t sz, int q) {
+  uint64_t     t;
+  unsigned int i;
+  int          err = 0;
+
+  for (i = 0; i < sec_adr.size(); i++) {
+    if ((sec_adr[i] + sec_sz[i] <= adr) || (sec_adr[i] >= adr + sz)) continue;
+    if (done[i]) continue;
+    done[i] = 1;
+    memset(&old[sec_adr[i]], 0xFF, sec_sz[i]);
+    if (q) {                                 // Erase, then Blank Check
+      struct fcmd e = { CQ_ERASE, base + sec_adr[i], 0, 0, 0 };
+      struct fcmd b = { CQ_BLANK, base + sec_adr[i], sec_sz[i], 0, 0 };
+      queue.push_back(e);
+      queue.push_back(b);
+      continue;
+    }
+    t = Sim::Now();
+    if (EraseSector(base + sec_adr[i])) {
+      fprintf(stderr, "EraseSector(0x%X) failed\n", base + sec_adr[i]);
+      err = 1;
+    }
+    if (Sim::Now() - t > (uint64_t) FlashDevice.toErase * 1000000) slow++;
+  }
+  return (err);
+}
+
+
+/*
+ *  CRC32 of the Image (reflected Polynomial 0xEDB88320, as Crc32)
+ */
+
+static uint32_t ImageCrc (void) {
+  uint32_t crc = 0xFFFFFFFF, i;
+  int      j;
+
+  for (i = 0; i < img.size(); i++) {
+    crc ^= img[i];
+    for (j = 0; j < 8; j++) crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+  }
+  return (crc ^ 0xFFFFFFFF);
+}
+
+
+/*
+ *  Run the collected Command Queue in one Call and check each Entry
+ *    Parameter:      data: Program Data
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+static int Run (std::vector<uint8_t> &data) {
+  std::vector<unsigned long> stat(queue.size() + 1, 0xFFFFFFFF);
+  unsigned int i, j;
+  int          err;
+
+  if (queue.empty()) return (0);
+  for (i = 0; i < queue.size(); i++) {
+    if (queue[i].op == CQ_PROGRAM) Load(queue[i].sz);
+  }
+  err = RunQueue(&queue[0], queue.size(), data.empty() ? NULL : &data[0], data.size(), &stat[0]);
+  for (i = 0; i < queue.size(); i++) {
+    if ((queue[i].op == CQ_ERASE) && (stat[i] == CQ_PENDING)) {
+      continue;                              // Result with the next Call
+    }
+    if ((queue[i].op == CQ_ERASE) && (stat[i] == CQ_OK)) {
+      for (j = 0; j < sec_adr.size(); j++) {
+        if (base + sec_adr[j] == queue[i].adr) done[j] = 1;
+      }
+    }
+    if (stat[i] != CQ_OK) {
+      fprintf(stderr, "RunQueue: entry %u (op %u at 0x%X): status %u\n", i,
+              (unsigned int) queue[i].op, (unsigned int) queue[i].adr, (unsigned int) stat[i]);
+      err = 1;
+    } else if ((queue[i].op == CQ_CRC) && (queue[i].res != ImageCrc())) {
+      fprintf(stderr, "RunQueue: CRC32 0x%08X, expected 0x%08X\n",
+              (unsigned int) queue[i].res, ImageCrc());
+      err = 1;
+    }
+  }
+  if (stat[queue.size()] != 0xFFFFFFFF) err = 1;   // Status written beyond n
+  queue.clear();
+  return (err != 0);
+}
+
+
+/*
+ *  Malformed Program Entries (Data beyond buf, Size wrapping around,
+ *  unaligned Offset) are rejected without Flash Access, the next Entry
+ *  is skipped
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+static int BadArg (std::vector<uint8_t> &data, int bus) {
+  const uint32_t bad[3][2] = {               // Size, Offset
+    { 8,          (uint32_t) data.size() - 2 },
+    { 0xFFFFFFFF, 0 },
+    { 4,          1 },
+  };
+  unsigned long stat[2];
+  uint64_t      acc = Sim::stats.rd + Sim::stats.wr;
+  int           i, err = 0;
+
+  for (i = 0; i < ((bus == 1) ? 2 : 3); i++) {
+    struct fcmd c[2] = { { CQ_PROGRAM, base, bad[i][0], bad[i][1], 0 },
+                         { CQ_CRC,     base, 4,         0,         0 } };
+    if ((RunQueue(c, 2, &data[0], data.size(), stat) != 1) ||
+        (stat[0] != CQ_BADARG) || (stat[1] != CQ_SKIPPED)) {
+      fprintf(stderr, "RunQueue: size 0x%X at offset 0x%X: status %u, expected %u\n",
+              bad[i][0], bad[i][1], (unsigned int) stat[0], CQ_BADARG);
+      err = 1;
+    }
+  }
+  if (Sim::stats.rd + Sim::stats.wr != acc) {
+    fprintf(stderr, "RunQueue: malformed entries accessed the flash\n");
+    err = 1;
+  }
+  return (err);
+}
+
+
+/*
+ *  Pipelined Queue (-Q -m): on the first Page of a Sector run the Pages
+ *  queued so far, then queue the Erase of the Sector (the Result of the
+ *  Background Erase when it was started ahead) with its Blank Check and
+ *  the Erase of the next Sector of the Image ahead of the Pages
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+static int Pipe (uint32_t adr, uint32_t sz, uint32_t end, std::vector<uint8_t> &data) {
+  unsigned int i;
+  int          err;
+
+  for (i = 0; i < sec_adr.size(); i++) {
+    if ((sec_adr[i] + sec_sz[i] > adr) && (sec_adr[i] < adr + sz) && !done[i]) break;
+  }
+  if (i == sec_adr.size()) return (0);       // Page in erased Sectors
+  err = Run(data);
+  Erase(base, adr, sz, 1);
+  for (i = 0; i < sec_adr.size(); i++) {     // next Sector of the Image
+    if ((sec_adr[i] >= adr + sz) && (sec_adr[i] < end) && !done[i]) {
+      struct fcmd e = { CQ_ERASE, base + sec_adr[i], 0, 0, 0 };
+      memset(&old[sec_adr[i]], 0xFF, sec_sz[i]);
+      queue.push_back(e);
+      break;
+    }
+  }
+  return (err);
+}
+
+
+#ifdef PROGRAM_PAGES
+/*
+ *  Host Side of ProgramPages (-D), run on each Target Access to the
+ *  Double Buffer: a Buffer set DB_EMPTY is filled from that Time on at
+ *  the Download Rate, Page after Page, and set DB_FULL when the Page
+ *  is loaded, Size 0 ends
+ */
+
+static uint32_t db_ofs, db_pos, db_size, db_page;  // Image, next Page
+static uint32_t db_i;                        // Buffer filled next
+static uint64_t db_ready;                    // End of the running Download
+static int      db_fill, db_end;             // Download running, Size 0 sent
+
+static void DbHost (void) {
+  struct dbuf *b;
+  uint32_t     n;
+
+  for (;;) {
+    b = &db[db_i];
+    if (db_fill) {
+      if (Sim::Now() < db_ready) return;
+      b->state.Set(DB_FULL);                 // Page loaded
+      db_fill = 0;
+      db_i   ^= 1;
+      continue;
+    }
+    if (db_end || (b->state.Get() != DB_EMPTY)) return;
+    n = db_page - ((db_ofs + db_pos) % db_page);
+    if (n > db_size - db_pos) n = db_size - db_pos;
+    memset(b->data, 0xFF, DB_PAGE);          // Padding as for ProgramPage
+    if (n) memcpy(b->data, &img[db_pos], n);
+    b->adr.Set(base + db_ofs + db_pos);
+    b->sz.Set(n);                            // Size 0: End of Data
+    if (db_ready < b->state.Time()) db_ready = b->state.Time();
+    db_ready += Xfer(n);
+    db_pos   += n;
+    db_fill   = 1;
+    db_end    = (n == 0);
+  }
+}
+
+
+/*
+ *  Program the Image through ProgramPages (Host Side: DbHost)
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+static int Pages (uint32_t ofs, uint32_t size, uint32_t page) {
+  int r;
+
+  db[0].state.Set(DB_EMPTY);                 // Reset Mailbox
+  db[1].state.Set(DB_EMPTY);
+  db_stat.Set(0);
+  db_ofs   = ofs;
+  db_pos   = 0;
+  db_size  = size;
+  db_page  = page;
+  db_i     = 0;
+  db_fill  = 0;
+  db_end   = 0;
+  db_ready = Sim::Now();
+  Sim::Host(DbHost);
+  r = ProgramPages();
+  Sim::Host(NULL);
+  if (r || (db_stat.Get() != 1) || !db_end) {
+    fprintf(stderr, "ProgramPages failed (status %u)\n", (unsigned int) db_stat.Get());
+    return (1);
+  }
+  return (0);
+}
+#endif
+
+
+/*
+ *  Expected Counters: SKIP_EMPTY programs only the Bus Words of the
+ *  padded Page that differ from the erased Value (one Operation per
+ *  Device), Verify reads one Bus Word at a time, then the Bytes left
+ */
+
+static uint64_t exp_prog, exp_vrd;           // Expected Program Ops, Verify Reads
+static uint64_t vrd;                         // Verify Reads (without Init)
+
+static void Expect (uint32_t ofs, uint32_t size, uint32_t page, int bus) {
+  uint32_t adr, n, w, k, i;
+  int      ff;
+
+  exp_prog = 0;
+  exp_vrd  = 0;
+  for (adr = ofs; adr < ofs + size; adr += n) {
+    n = page - (adr % page);
+    if (n > ofs + size - adr) n = ofs + size - adr;
+    for (w = 0; w < n; w += bus) {
+      for (ff = 1, k = 0; k < (uint32_t) bus; k++) {
+        i = adr - ofs + w + k;
+        if ((w + k < n) && (img[i] != 0xFF)) ff = 0;
+      }
+      if (!ff) exp_prog += (bus == 4) ? 2 : 1;
+    }
+    exp_vrd += n / bus + n % bus;
+  }
+}
+
+
+static double Ms (uint64_t t) {
+  return (t / 1e6);
+}
+
+struct Phase {                               // Results of one Phase
+  uint64_t   ns;
+  Sim::Stats s;
+};
+
+static Phase phase[3];                       // Erase, Program, Verify
+static int   json;
+
+static void Report (int n, const char *name, uint64_t t, uint32_t bytes) {
+  phase[n].ns = t;
+  phase[n].s  = Sim::stats;
+  if (json) return;
+  printf("  %-13s %10.3f ms", name, Ms(t));
+  if (bytes && t) printf("  %8.1f kB/s", bytes / 1024.0 / (t / 1e9));
+  printf("   rd %u  wr %u  polls %u  prog %u  buf %u  erase %u/%u  suspend %u  fail %u\n",
+         (unsigned int) Sim::stats.rd, (unsigned int) Sim::stats.wr,
+         (unsigned int) Sim::stats.polls, (unsigned int) Sim::stats.prog,
+         (unsigned int) Sim::stats.buf, (unsigned int) Sim::stats.erase,
+         (unsigned int) Sim::stats.sectors, (unsigned int) Sim::stats.suspend,
+         (unsigned int) Sim::stats.fail);
+}
+
+
+/*
+ *  Generated Image
+ *    Return Value:   0 - OK,  1 - unknown Pattern
+ */
+
+static int Pattern (const char *pat, uint32_t *ofs, uint32_t *size) {
+  uint32_t     i, max = 0;
+  unsigned int j, k;
+
+  if (!strcmp(pat, "boot")) {                // Sectors smaller than largest
+    for (j = 0; j < sec_sz.size(); j++) if (sec_sz[j] > max) max = sec_sz[j];
+    for (j = 0; (j < sec_sz.size()) && (sec_sz[j] == max); j++);
+    if (j == sec_sz.size()) j = 0;           // Uniform: first Sector
+    for (k = j + 1; (k < sec_sz.size()) && (sec_sz[k] < max); k++);
+    *ofs  = sec_adr[j];
+    *size = sec_adr[k - 1] + sec_sz[k - 1] - sec_adr[j];
+  }
+  img.resize(*size);
+  for (i = 0; i < *size; i++) {
+    if      (!strcmp(pat, "zero"))   img[i] = 0x00;
+    else if (!strcmp(pat, "sparse")) img[i] = (Random() < 16) ? Random() : 0xFF;
+    else if (!strcmp(pat, "random") || !strcmp(pat, "boot")) img[i] = Random();
+    else return (1);
+  }
+  return (0);
+}
+
+
+static void JsonPhase (const char *name, const Phase &p, int last) {
+  printf("  \"%s\": {\"ns\": %" PRIu64 ", \"rd\": %" PRIu64 ", \"wr\": %" PRIu64 ", \"polls\": %" PRIu64 ", "
+         "\"prog\": %" PRIu64 ", \"buf\": %" PRIu64 ", \"erase\": %" PRIu64 ", \"sectors\": %" PRIu64 ", "
+         "\"suspend\": %" PRIu64 ", \"fail\": %" PRIu64 "}%s\n", name,
+         p.ns, p.s.rd,
+         p.s.wr, p.s.polls,
+         p.s.prog, p.s.buf,
+         p.s.erase, p.s.sectors,
+         p.s.suspend, p.s.fail,
+         last ? "" : ",");
+}
+
+static double Div (double a, double b) {
+  return (b ? (a / b) : 0);
+}
+
+static void Json (const char *algo, const char *pat, int bus, uint32_t ofs,
+                  uint32_t size, const Sim::Timing &tm, uint32_t wb, int err) {
+  char         pe[24];
+  const Phase &e = phase[0], &p = phase[1], &v = phase[2];
+  double       mb = size / 1048576.0;
+
+  printf("{\"algo\": \"%s\", \"device\": \"%s\", \"bus\": %d, \"pattern\": \"%s\",\n",
+         algo, FlashDevice.DevName, bus * 8, pat);
+  printf("  \"offset\": %u, \"size\": %u, \"timing\": \"%s\", \"access_ns\": %u,\n",
+         ofs, size, (tm.mode == 1) ? "max" : (tm.mode == 2) ? "rand" : "typ", tm.access);
+  JsonPhase("erase",   e, 0);
+  JsonPhase("program", p, 0);
+  JsonPhase("verify",  v, 0);
+  printf("  \"rd_per_byte\": %.3f, \"wr_per_byte\": %.3f,\n",
+         Div(p.s.rd, size), Div(p.s.wr, size));
+  printf("  \"polls_per_prog\": %.1f, \"polls_per_erase\": %.1f,\n",
+         Div(p.s.polls, p.s.prog + p.s.buf), Div(e.s.polls, e.s.erase));
+  printf("  \"s_per_mb\": {\"erase\": %.4f, \"program\": %.4f, \"verify\": %.4f, \"total\": %.4f},\n",
+         e.ns / 1e9 / mb, p.ns / 1e9 / mb, v.ns / 1e9 / mb, (e.ns + p.ns + v.ns) / 1e9 / mb);
+  if (wb) strcpy(pe, "null");                // Buffer Programming: no Word Skip
+  else     snprintf(pe, sizeof(pe), "%" PRIu64, exp_prog);
+  printf("  \"check\": {\"prog\": %" PRIu64 ", \"prog_expected\": %s, "
+         "\"verify_rd\": %" PRIu64 ", \"verify_rd_expected\": %" PRIu64 "},\n",
+         p.s.prog, pe, vrd, exp_vrd);
+  printf("  \"ok\": %s}\n", err ? "false" : "true");
+}
+
+
+int main (int argc, char **argv) {
+  Sim::Timing tm = { 9, 200, 0, 0, 700, 3000, 0, 1, 100 };   // AM29LV
+  const char *layout = NULL, *file = NULL, *pat = "random", *algo;
+  uint32_t    size = 0x10000, ofs = 0, dev, page, adr, n, clk;
+  uint32_t    wb = 0, i;
+  uint64_t    t0, t;
+  int         bus, chip = 0, merge = 0, erased = 0, err = 0, c, q = 0, ahead = 0;
+  int         dbl = 0;
+  std::vector<uint8_t> buf, data;
+  FILE       *f;
+
+  switch (FlashDevice.DevType) {
+    case EXT8BIT:  bus = 1; break;
+    case EXT32BIT: bus = 4; break;
+    default:       bus = 2; break;
+  }
+  while ((c = getopt(argc, argv, "s:o:g:t:p:q:e:w:a:b:L:x:cmfjQAD")) != -1) {
+    switch (c) {
+      case 's': size = Size(optarg);                        break;
+      case 'o': ofs  = Size(optarg);                        break;
+      case 'g': pat  = optarg;                              break;
+      case 't': tm.mode = !strcmp(optarg, "max") ? 1 : !strcmp(optarg, "rand") ? 2 : 0; break;
+      case 'p': Range(optarg, &tm.prog_typ,  &tm.prog_max);  break;
+      case 'q': Range(optarg, &tm.buf_typ,   &tm.buf_max);   break;
+      case 'e': Range(optarg, &tm.erase_typ, &tm.erase_max); break;
+      case 'w': wb   = Size(optarg);                        break;
+      case 'a': tm.access = strtoul(optarg, NULL, 0);       break;
+      case 'b': bus  = strtoul(optarg, NULL, 0) / 8;        break;
+      case 'L': layout = optarg;                            break;
+      case 'x': xfer   = strtoul(optarg, NULL, 0);          break;
+      case 'c': chip   = 1;                                 break;
+      case 'm': merge  = 1;                                 break;
+      case 'f': erased = 1;                                 break;
+      case 'j': json   = 1;                                 break;
+      case 'Q': q      = 1;                                 break;
+      case 'A': ahead  = 1;                                 break;
+      case 'D': dbl    = 1;                                 break;
+      default:  return (2);
+    }
+  }
+  if (optind < argc) file = argv[optind];
+  if ((bus != 1) && (bus != 2) && (bus != 4)) {
+    fprintf(stderr, "%s: bus width 8, 16 or 32\n", argv[0]);
+    return (2);
+  }
+  if (ahead && !(q && merge)) {
+    fprintf(stderr, "%s: -A needs -Q and -m\n", argv[0]);
+    return (2);
+  }
+#ifndef PROGRAM_PAGES
+  if (dbl) {
+    fprintf(stderr, "%s: -D needs ProgramPages (Double Buffer)\n", argv[0]);
+    return (2);
+  }
+#endif
+  if (dbl && q) {
+    fprintf(stderr, "%s: -D and -Q exclude each other\n", argv[0]);
+    return (2);
+  }
+  if (wb && (tm.buf_typ == 0)) {
+    fprintf(stderr, "%s: write buffer needs -q (buffer program time)\n", argv[0]);
+    return (2);
+  }
+
+  dev  = Layout(layout);
+  base = FlashDevice.DevAdr;
+  page = FlashDevice.szPage;
+  if (dev == 0) {
+    fprintf(stderr, "%s: bad layout\n", argv[0]);
+    return (2);
+  }
+  if (dbl && (page > DB_PAGE)) {
+    fprintf(stderr, "%s: page size above double buffer (%u bytes)\n", argv[0], DB_PAGE);
+    return (2);
+  }
+  if (file) {
+    f = fopen(file, "rb");
+    if (f == NULL) {
+      perror(file);
+      return (2);
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    img.resize(size);
+    if (size && (fread(&img[0], 1, size, f) != size)) {
+      fprintf(stderr, "%s: read failed\n", file);
+      return (2);
+    }
+    fclose(f);
+    pat = "file";
+  } else if (Pattern(pat, &ofs, &size)) {
+    fprintf(stderr, "%s: unknown pattern %s\n", argv[0], pat);
+    return (2);
+  }
+  if ((size == 0) || (ofs + size > dev)) {
+    fprintf(stderr, "%s: image does not fit into device (%u bytes)\n", argv[0], dev);
+    return (2);
+  }
+
+  Sim::Setup(bus, base, dev, sec_adr.size(), &sec_adr[0], &sec_sz[0], wb, tm);
+  old.resize(dev);
+  done.assign(sec_adr.size(), 0);
+  for (i = 0; i < dev; i++) {
+    old[i] = erased ? 0xFF : Random();
+    Sim::Poke(base + i, old[i]);
+  }
+  clk = 16000000000ULL / tm.access;          // CPU Clock: 16 Cycles per Access
+
+  algo = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+  if (!strncmp(algo, "sim-", 4)) algo += 4;
+  if (!json) printf("%s: %s, %u-bit bus, %u sectors, image %u bytes at 0x%X\n", argv[0],
+         FlashDevice.DevName, bus * 8, (unsigned int) sec_adr.size(), size, ofs);
+
+  // Erase Phase (with -m: Erase Sectors, then Program in one Session,
+  // with -Q -m: Erases queued per Sector with the Pages, see Pipe)
+  Sim::Clear();
+  t0 = Sim::Now();
+  err |= Init(base, clk, merge ? 2 : 1);
+  if (chip) {
+    err |= EraseChip();
+    for (i = 0; i < dev; i++) old[i] = 0xFF;
+  } else if (!(q && merge)) {
+    err |= Erase(base, ofs, size, q);
+  }
+
+  // Program Phase
+  if (!merge) {
+    if (q) err |= Run(data);
+    err |= UnInit(1);
+    Report(0, "Erase", Sim::Now() - t0, 0);
+    Sim::Clear();
+    t0 = Sim::Now();
+    err |= Init(base, clk, 2);
+  }
+  if (q) {
+    data = img;
+    data.resize(size + 4, 0xFF);             // Padding as for ProgramPage
+    err |= BadArg(data, bus);
+  }
+#ifdef PROGRAM_PAGES
+  if (dbl) err |= Pages(ofs, size, page);
+#endif
+  for (adr = ofs; !dbl && (adr < ofs + size); adr += n) {
+    n = page - (adr % page);                 // Page aligned as by Debugger
+    if (n > ofs + size - adr) n = ofs + size - adr;
+    if (q) {
+      if (merge && !chip) err |= Pipe(adr, n, ofs + size, data);
+      struct fcmd p = { CQ_PROGRAM, base + adr, n, adr - ofs, 0 };
+      queue.push_back(p);
+      continue;
+    }
+    buf.assign(n + 4, 0xFF);
+    memcpy(&buf[0], &img[adr - ofs], n);
+    Load(n);
+    t = Sim::Now();
+    if (ProgramPage(base + adr, n, &buf[0])) {
+      fprintf(stderr, "ProgramPage(0x%X, %u) failed\n", base + adr, n);
+      err = 1;
+      break;
+    }
+    if (Sim::Now() - t > (uint64_t) FlashDevice.toProg * 1000000) slow++;
+  }
+  if (q) {
+    struct fcmd c = { CQ_CRC, base + ofs, size, 0, 0 };
+    queue.push_back(c);
+    err |= Run(data);
+  }
+  err |= UnInit(2);
+  Report(1, merge ? "Erase+Program" : "Program", Sim::Now() - t0, size);
+
+  // Verify Phase
+  Sim::Clear();
+  t0 = Sim::Now();
+  err |= Init(base, clk, 3);
+  vrd = Sim::stats.rd;                       // Reads of Init not counted
+  for (adr = ofs; adr < ofs + size; adr += n) {
+    n = page - (adr % page);
+    if (n > ofs + size - adr) n = ofs + size - adr;
+    if (Verify(base + adr, n, &img[adr - ofs]) != base + adr + n) {
+      fprintf(stderr, "Verify(0x%X, %u) failed\n", base + adr, n);
+      err = 1;
+      break;
+    }
+  }
+  vrd = Sim::stats.rd - vrd;
+  err |= UnInit(3);
+  Report(2, "Verify", Sim::Now() - t0, size);
+
+  // Counters: Skip of erased Words (Word Programming only) and Verify
+  Expect(ofs, size, page, bus);
+  if ((wb == 0) && (phase[1].s.prog != exp_prog)) {
+    fprintf(stderr, "program: %u word programs, expected %u\n",
+            (unsigned int) phase[1].s.prog, (unsigned int) exp_prog);
+    err = 1;
+  }
+  if (vrd != exp_vrd) {
+    fprintf(stderr, "verify: %u bus reads, expected %u\n",
+            (unsigned int) vrd, (unsigned int) exp_vrd);
+    err = 1;
+  }
+  if (ahead && (phase[1].s.suspend == 0)) {
+    fprintf(stderr, "erase-ahead: no erase suspended\n");
+    err = 1;
+  }
+
+  // Model Content: Image, erased Remainder of Sectors, others untouched
+  for (i = 0; i < size; i++) old[ofs + i] = img[i];
+  for (i = 0; i < dev; i++) {
+    if (Sim::Peek(base + i) != old[i]) {
+      fprintf(stderr, "content mismatch at 0x%X: 0x%02X, expected 0x%02X\n",
+              base + i, Sim::Peek(base + i), old[i]);
+      err = 1;
+      break;
+    }
+  }
+  if (json) {
+    Json(algo, pat, bus, ofs, size, tm, wb, err);
+    return (err != 0);
+  }
+  if (slow) printf("  WARNING: %u operations exceeded the FlashDevice timeout\n", slow);
+  printf("  %s\n", err ? "FAILED" : "OK");
+  return (err != 0);
+}
@@ -0,0 +1,18 @@
+/* -----------------------------------------------------------------------------
+ * Project:      Sector size and timeouts of the LPC18xx/LPC43xx SPIFI Flash
+ *               targets, shared by FlashDev.c (FlashDevice) and FlashPrg.c
+ *
+ * The debugger reads FlashDevice from the algorithm image but does not
+ * download it, so FlashPrg.c checks the device against these defines.
+ * --------------------------------------------------------------------------- */
+
+#if defined(SUBBLK_4K) || defined(SPIFI_SFDP)
+#define SECTOR_SIZE      0x001000   /* 4 KB sub-block sectors */
+#elif defined(S25FL512) || defined(S25FL256_256K)
+#define SECTOR_SIZE      0x040000   /* 256 KB erase block sectors */
+#else
+#define SECTOR_SIZE      0x010000   /* 64 KB erase block sectors */
+#endif
+
+#define TO_PROG               500   /* Program page timeout (ms) */
+#define TO_ERASE             5000   /* Erase sector timeout (ms) */
@@ -30,29 +30,122 @@
  *    Initial release
  */ 
 
+/* Define SUBBLK_4K (C/C++ and project Define, shared with FlashPrg.c)
+ * to list 4 KB sub-block sectors instead of the erase blocks
+ * (Init fails for devices without sub-block erase).
+ * Define SPIFI_SFDP (with SPIFI_DRV_OPEN) for any JESD216 device, its
+ * geometry is detected at run time (see spifi_drv.c), Init fails for
+ * devices without 4 KB erase.
+ * S25FL256 (64 KB sectors), S25FL256_256K (uniform 256 KB sectors) and
+ * S25FL512 (above 16 MB, 4-byte addresses) need SPIFI_DRV_OPEN.
+ * Init fails if the device erase block differs from the sector size
+ * (SECTOR_SIZE in FlashCfg.h).
+ */
+
 #include "../FlashOS.H"        // FlashOS Structures
+#include "FlashCfg.h"          // Sector Size, Timeouts
+
+#ifdef SPIFI_SFDP
+struct FlashDevice const FlashDevice = {
+   FLASH_DRV_VERS,             // Driver Version, do not modify!
+   "LPC18xx/43xx SPIFI (SFDP)", // Device Name 
+   EXTSPI,                     // Device Type
+   0x14000000,                 // Device Start Address
+   0x04000000,                 // Device Size is 64MB max. (SPIFI window)
+   256,                        // Programming Page Size
+   0,                          // Reserved, must be 0
+   0xFF,                       // Initial Content of Erased Memory
+   TO_PROG,                    // Program Page Timeout 500 mSec
+   TO_ERASE,                   // Erase Sector Timeout 5000 mSec
+
+// Specify Size and Address of Sectors
+   SECTOR_SIZE, 0,             // sectors are 4 KB (smallest erase type)
+   SECTOR_END
+};
+#endif
+
+
+#if defined(S25FL512) && !defined(SPIFI_SFDP)
+struct FlashDevice const FlashDevice = {
+   FLASH_DRV_VERS,             // Driver Version, do not modify!
+   "LPC18xx/43xx S25FL512 SPIFI", // Device Name 
+   EXTSPI,                     // Device Type
+   0x14000000,                 // Device Start Address
+   0x04000000,                 // Device Size is 64MB
+   512,                        // Programming Page Size
+   0,                          // Reserved, must be 0
+   0xFF,                       // Initial Content of Erased Memory
+   TO_PROG,                    // Program Page Timeout 500 mSec
+   TO_ERASE,                   // Erase Sector Timeout 5000 mSec
+
+// Specify Size and Address of Sectors
+   SECTOR_SIZE, 0,             // sectors are 256 KB (4 KB with SUBBLK_4K)
+   SECTOR_END
+};
+#endif
+
+
+#if defined(S25FL256) && !defined(SPIFI_SFDP)
+struct FlashDevice const FlashDevice = {
+   FLASH_DRV_VERS,             // Driver Version, do not modify!
+   "LPC18xx/43xx S25FL256 SPIFI", // Device Name 
+   EXTSPI,                     // Device Type
+   0x14000000,                 // Device Start Address
+   0x02000000,                 // Device Size is 32MB
+   256,                        // Programming Page Size
+   0,                          // Reserved, must be 0
+   0xFF,                       // Initial Content of Erased Memory
+   TO_PROG,                    // Program Page Timeout 500 mSec
+   TO_ERASE,                   // Erase Sector Timeout 5000 mSec
+
+// Specify Size and Address of Sectors
+   SECTOR_SIZE, 0,             // sectors are 64 KB (4 KB with SUBBLK_4K)
+   SECTOR_END
+};
+#endif
+
+
+#if defined(S25FL256_256K) && !defined(SPIFI_SFDP)
+struct FlashDevice const FlashDevice = {
+   FLASH_DRV_VERS,             // Driver Version, do not modify!
+   "LPC18xx/43xx S25FL256 256KB SPIFI", // Device Name 
+   EXTSPI,                     // Device Type
+   0x14000000,                 // Device Start Address
+   0x02000000,                 // Device Size is 32MB
+   512,                        // Programming Page Size
+   0,                          // Reserved, must be 0
+   0xFF,                       // Initial Content of Erased Memory
+   TO_PROG,                    // Program Page Timeout 500 mSec
+   TO_ERASE,                   // Erase Sector Timeout 5000 mSec
+
+// Specify Size and Address of Sectors
+   SECTOR_SIZE, 0,             // sectors are 256 KB (4 KB with SUBBLK_4K)
+   SECTOR_END
+};
+#endif
+
 
-#ifdef S25FL064
+#if defined(S25FL064) && !defined(SPIFI_SFDP)
 struct FlashDevice const FlashDevice = {
    FLASH_DRV_VERS,             // Driver Version, do not modify!
    "LPC18xx/43xx S25FL064 SPIFI", // Device Name 
    EXTSPI,                     // Device Type
    0x14000000,                 // Device Start Address
-   0x00800000,                 // Device Size is 4MB
+   0x00800000,                 // Device Size is 8MB
    256,                        // Programming Page Size
    0,                          // Reserved, must be 0
    0xFF,                       // Initial Content of Erased Memory
-   500,                        // Program Page Timeout 100 mSec
-   5000,                       // Erase Sector Timeout 3000 mSec
+   TO_PROG,                    // Program Page Timeout 500 mSec
+   TO_ERASE,                   // Erase Sector Timeout 5000 mSec
 
 // Specify Size and Address of Sectors
-   0x010000, 0,                // sectors are 64 KB
+   SECTOR_SIZE, 0,             // sectors are 64 KB (4 KB with SUBBLK_4K)
    SECTOR_END
 };
 #endif
 
 
-#ifdef S25FL032
+#if defined(S25FL032) && !defined(SPIFI_SFDP)
 struct FlashDevice const FlashDevice = {
    FLASH_DRV_VERS,             // Driver Version, do not modify!
    "LPC18xx/43xx S25FL032 SPIFI", // Device Name 
@@ -62,11 +155,11 @@ struct FlashDevice const FlashDevice = {
    256,                        // Programming Page Size
    0,                          // Reserved, must be 0
    0xFF,                       // Initial Content of Erased Memory
-   500,                        // Program Page Timeout 100 mSec
-   5000,                       // Erase Sector Timeout 3000 mSec
+   TO_PROG,                    // Program Page Timeout 500 mSec
+   TO_ERASE,                   // Erase Sector Timeout 5000 mSec
 
 // Specify Size and Address of Sectors
-   0x010000, 0,                // sectors are 64 KB
+   SECTOR_SIZE, 0,             // sectors are 64 KB (4 KB with SUBBLK_4K)
    SECTOR_END
 };
 
@@ -32,11 +32,26 @@
 
 #include <stdbool.h>
 #include "../FlashOS.H"        // FlashOS Structures
-#include "spifilib_api.h"
+#include "../FlashQueue.H"     // Command Queue (RunQueue)
+#include "spifilib_api.h"      /* lib_lpcspifi_M3_PI.lib, spifi_drv.c if SPIFI_DRV_OPEN */
+#include "FlashCfg.h"          /* SECTOR_SIZE, TO_PROG, TO_ERASE (as in FlashDev.c) */
 
 
+#define CGU_PLL1_STAT           (*(volatile unsigned long *)0x40050040)
+#define CGU_PLL1_CTRL           (*(volatile unsigned long *)0x40050044)
+#define CGU_IDIV_CTRL(i)        (*(volatile unsigned long *)(0x40050048 + 4 * (i)))  /* IDIVA..IDIVE */
+#define CGU_BASE_CLK(i)         (*(volatile unsigned long *)(0x40050060 + 4 * (i)))  /* BASE_USB0..CGU_OUT1 */
+#define CGU_BASE_M3_CLK         (*(volatile unsigned long *)0x4005006C)
 #define CGU_BASE_SPIFI0_CLK     (*(volatile unsigned long *)0x40050070)
 
+#define CLK_IRC              0x01   /* CGU clock source: IRC */
+#define CLK_PLL1             0x09   /* CGU clock source: PLL1 */
+#define CLK_IDIVA            0x0C   /* CGU clock source: IDIVA (IDIVB..IDIVE follow) */
+#define IDIV_NUM                5   /* Integer dividers IDIVA..IDIVE */
+#define BASE_NUM               27   /* Base clock registers 0x60..0xC8 */
+#define BASE_M3                 3   /* Index of BASE_M3_CLK */
+#define BASE_SPIFI              4   /* Index of BASE_SPIFI_CLK */
+
 #define SCU_SFSP3_3             (*(volatile unsigned long *)0x4008618C)
 #define SCU_SFSP3_4             (*(volatile unsigned long *)0x40086190)
 #define SCU_SFSP3_5             (*(volatile unsigned long *)0x40086194)
@@ -45,12 +60,99 @@
 #define SCU_SFSP3_8             (*(volatile unsigned long *)0x400861A0)
 
 #define SPIFI_BASE                                          0x40003000
+#define SPIFI_CTRL              (*(volatile unsigned long *)0x40003000)
+#define SPIFI_CMD               (*(volatile unsigned long *)0x40003004)
+#define SPIFI_DATA8             (*(volatile unsigned char *)0x40003014)
+#define SPIFI_STAT              (*(volatile unsigned long *)0x4000301C)
+
+#define DEMCR                   (*(volatile unsigned long *)0xE000EDFC)
+#define DWT_CTRL                (*(volatile unsigned long *)0xE0001000)
+#define DWT_CYCCNT              (*(volatile unsigned long *)0xE0001004)
+
+#define SKIP_EMPTY              1   /* Skip device pages that are all erased (0xFF) */
+#define ERASE_SKIP              1   /* Skip erase of blocks that are already blank */
+#define USE_QUAD                1   /* Quad I/O program and read if supported (0 - single) */
+#define HS_CLOCK                1   /* Run core and SPIFI from PLL1 (0 - 12 MHz IRC) */
+#define IRC_CLOCK        12000000   /* IRC frequency, PLL1 input */
+#define CORE_DEF         96000000   /* Core clock if Init clk is not above the IRC */
+#define CORE_MAX         96000000   /* Core clock limit (no base clock ramp below 110 MHz) */
+#define PLL_LOCK_TMO       100000   /* PLL1 lock timeout (poll iterations) */
+#define RAMP_CYCLES         10000   /* BASE_M3 ramp step, 50 us at PLL1 / 2 (204 MHz PLL1) */
+#define CMD_SESSION             1   /* Stay in command mode for erase/program phase (0 - per call) */
+#define SCAN_SIZE             256   /* Blank scan chunk read in command mode */
+#define NO_BLOCK                1   /* Return after issuing program/erase (0 - blocking) */
+#define HANDLE_CACHE            1   /* Reuse the detected device on later Init calls (0 - detect each time) */
+#if defined(SPIFI_SFDP) && !defined(SPIFI_DRV_OPEN)
+#error "SPIFI_SFDP needs the open driver (SPIFI_DRV_OPEN)"
+#endif
+#if (defined(S25FL256) || defined(S25FL256_256K) || defined(S25FL512)) && !defined(SPIFI_DRV_OPEN)
+#error "S25FL256/S25FL512 (4-byte addresses) need the open driver (SPIFI_DRV_OPEN)"
+#endif
+#if defined(SUBBLK_4K) || defined(SPIFI_SFDP)
+#define SUBBLK_ERASE            1   /* FlashDev.c lists 4 KB sub-block sectors */
+#else
+#define SUBBLK_ERASE            0   /* FlashDev.c lists erase block sectors */
+#endif
+#define CMD_RDCR             0x35   /* Read Configuration Register (S25FL, QE is bit 1) */
+#define CR_QUAD              0x02   /* Configuration Register Quad Enable bit */
+#define CMD_RDID             0x9F   /* Read JEDEC ID */
+#define CACHE_NONE     0xFFFFFFFF   /* Handle cache: not valid */
+#define CACHE_USED     0x55534544   /* Handle cache: handle in use (Init to UnInit) */
+#define CACHE_SIG      0x53504643   /* Handle cache: valid */
+#define DB_PAGE              1024   /* Double buffer page size (ProgramPages) */
+#define DB_EMPTY                0   /* Buffer state: free for host */
+#define DB_FULL                 1   /* Buffer state: filled by host */
+#define DB_WAIT_MS           1000   /* Host buffer fill timeout (ms) */
+
+typedef struct {                             /* Double buffer, layout used by host */
+  volatile uint32_t state;                   /* DB_EMPTY, DB_FULL */
+  volatile uint32_t adr;                     /* page start address */
+  volatile uint32_t sz;                      /* page size (0 - end of data) */
+  uint8_t           data[DB_PAGE];           /* page data */
+} DBUF_T;
+
+typedef struct {                             /* Detected device kept for later Init calls */
+  uint32_t sig;                              /* CACHE_SIG, CACHE_USED, CACHE_NONE */
+  uint32_t adr;                              /* Device base address */
+  uint32_t id;                               /* JEDEC ID (manufacturer, type, capacity) */
+  uint32_t ctrl;                             /* SPIFI_CTRL when stored */
+  uint32_t sum;                              /* Checksum of pSpifi and handle memory */
+} HCACHE_T;
 
 uint32_t memSize;
-uint32_t lmem[21];
+uint32_t lmem[32];                           /* handle memory (21 words for the library) */
 SPIFI_HANDLE_T *pSpifi;
 
 unsigned long base_adr;
+uint32_t skipCnt;                            /* Number of skipped erased pages */
+uint32_t eraseSkipCnt;                       /* Number of skipped block erases */
+uint32_t crcTab[256];                        /* CRC32 lookup table */
+DBUF_T   dBuf[2];                            /* double buffer */
+volatile uint32_t dBufStat;                  /* ProgramPages status (1 - done, 2 - failed) */
+uint32_t spifiMode;                          /* I/O mode used: 1 - single, 4 - quad */
+uint32_t coreClock;                          /* Core clock used (Hz) */
+uint32_t spifiClock;                         /* SPIFI clock used (Hz) */
+uint32_t clkSaved;                           /* Clock tree saved by Init */
+uint32_t clkChanged;                         /* PLL1 and spifiDiv reprogrammed */
+uint32_t spifiDiv;                           /* Divider used for SPIFI (0 - IDIVA) */
+uint32_t savePll1, saveDiv, saveBaseM3, saveBaseSpifi;  /* application clock tree */
+uint32_t saveDemcr, saveDwtCtrl;             /* DWT cycle counter enables before Init */
+uint32_t memMode;                            /* SPIFI in memory mode */
+uint32_t cmdOps;                             /* Erase/program operations in command mode */
+uint32_t modeSwitches;                       /* Memory/command mode switches made */
+uint32_t modeCycles;                         /* Core cycles spent in mode switches */
+uint32_t scanBuf[SCAN_SIZE / 4];             /* blank scan buffer (command mode) */
+uint32_t noBlock;                            /* Non-blocking program/erase enabled */
+uint32_t devBusy;                            /* Program/erase issued, not yet completed */
+uint32_t busyAdr;                            /* Address of the pending operation */
+uint32_t busyTmo;                            /* Timeout of the pending operation (ms) */
+uint32_t deferErr;                           /* Pending operation failed, not yet reported */
+uint32_t failAdr;                            /* Address of the last failed operation */
+uint32_t blankFailAdr;                       /* First address failing BlankCheck */
+HCACHE_T hCache = { CACHE_NONE };            /* RW, not ZI: reloading the algorithm
+                                                invalidates it with the library data */
+uint32_t cacheHits;                          /* Init calls that reused the handle */
+uint32_t initCycles;                         /* Core cycles spent in the last Init */
 
 /* This function initializes all the RO, RW data in the PI library.
    It is called is called from the C library startup code.
@@ -59,31 +161,396 @@ unsigned long base_adr;
  */
 extern void __cpp_initialize__aeabi_(void); 
 
-/*  Initialize Flash Programming Functions
+#ifdef SPIFI_DRV_OPEN
+extern SPIFI_FAM_NODE_T *spifi_REG_FAMILY_SFDP(void);
+#endif
+
+/*  Read the device Configuration Register through the SPIFI command register
+ *  (device must not be in memMode)
+ *    Return Value:   Configuration Register value
+ */
+
+uint32_t ReadConfig (void) {
+  uint32_t cr;
+
+  SPIFI_CMD = (CMD_RDCR << 24) | (1 << 21) | 1;  /* opcode only, serial, 1 byte in */
+  cr = SPIFI_DATA8;
+  while (SPIFI_STAT & 2);                    /* wait for command end */
+
+  return (cr);
+}
+
+
+/*  Read the JEDEC ID through the SPIFI command register
+ *  (device must not be in memMode)
+ *    Return Value:   Manufacturer << 16 | Type << 8 | Capacity
+ */
+
+uint32_t ReadJedecId (void) {
+  uint32_t id;
+
+  SPIFI_CMD = (CMD_RDID << 24) | (1 << 21) | 3;  /* opcode only, serial, 3 bytes in */
+  id  = SPIFI_DATA8 << 16;
+  id |= SPIFI_DATA8 << 8;
+  id |= SPIFI_DATA8;
+  while (SPIFI_STAT & 2);                    /* wait for command end */
+
+  return (id);
+}
+
+
+/*  Checksum of the handle pointer and the handle memory
+ */
+
+uint32_t HandleSum (void) {
+  uint32_t sum, i;
+
+  sum = (uint32_t)pSpifi;
+  for (i = 0; i < sizeof(lmem) / 4; i++) {
+    sum = ((sum << 1) | (sum >> 31)) ^ lmem[i];
+  }
+
+  return (sum);
+}
+
+
+/*  Reuse the handle of an earlier Init when the cache is valid: same
+ *  signature, base address, handle memory checksum and SPIFI_CTRL (not
+ *  reset since), and the device returns the same JEDEC ID. The handle
+ *  is in use (CACHE_USED) until UnInit stores it again.
  *    Parameter:      adr:  Device Base Address
- *                    clk:  Clock Frequency (Hz)
- *                    fnc:  Function Code (1 - Erase, 2 - Program, 3 - Verify)
+ *    Return Value:   1 - Handle reused (command mode),  0 - Detect device
+ */
+
+int HandleReuse (unsigned long adr) {
+  uint32_t sig;
+
+  sig = hCache.sig;
+  hCache.sig = CACHE_NONE;
+  if (!HANDLE_CACHE || (sig != CACHE_SIG) || (hCache.adr != adr) ||
+      (hCache.sum != HandleSum()) || (hCache.ctrl != SPIFI_CTRL)) {
+    return (0);
+  }
+  if (spifiDevSetMemMode(pSpifi, false) != SPIFI_ERR_NONE) {
+    return (0);
+  }
+  if (ReadJedecId() != hCache.id) {
+    return (0);                              /* device changed */
+  }
+  hCache.sig = CACHE_USED;
+  cacheHits++;
+
+  return (1);
+}
+
+
+/*  Select quad I/O when the device reports quad read and write capability
+ *  The family driver sets the Quad Enable bit on spifiDevSetOpts(), it is
+ *  read back before quad mode is used (the open driver reads it back by
+ *  the method found in SFDP). Otherwise the option is cleared again and
+ *  single mode stays in use (spifiMode reports the result).
+ */
+
+void SetQuadMode (void) {
+  uint32_t caps;
+
+  spifiMode = 1;
+  caps = spifiDevGetInfo(pSpifi, SPIFI_INFO_CAPS);
+  if (!USE_QUAD || ((caps & SPIFI_CAP_QUAD_READWRITE) != SPIFI_CAP_QUAD_READWRITE)) {
+    return;                                  /* single mode only */
+  }
+
+  if ((spifiDevSetOpts(pSpifi, SPIFI_OPT_USE_QUAD, true) == SPIFI_ERR_NONE) &&
+#ifndef SPIFI_DRV_OPEN
+      (ReadConfig() & CR_QUAD) &&
+#endif
+      ((spifiDevGetInfo(pSpifi, SPIFI_INFO_OPTIONS) & SPIFI_OPT_USE_QUAD) == SPIFI_OPT_USE_QUAD)) {
+    spifiMode = 4;
+    return;
+  }
+
+  spifiDevSetOpts(pSpifi, SPIFI_OPT_USE_QUAD, false);  /* fall back to single mode */
+}
+
+
+/*  Save the clock tree of the application
+ */
+
+void ClockSave (void) {
+
+  savePll1      = CGU_PLL1_CTRL;
+  saveBaseM3    = CGU_BASE_M3_CLK;
+  saveBaseSpifi = CGU_BASE_SPIFI0_CLK;
+  clkChanged    = 0;
+  clkSaved      = 1;
+}
+
+
+/*  Check if a clock source feeds a base clock other than BASE_M3 and
+ *  BASE_SPIFI, directly or through a divider
+ *    Parameter:      src:  CGU clock source
+ *    Return Value:   1 - Used,  0 - Not used
+ */
+
+uint32_t ClockUsed (uint32_t src) {
+  uint32_t i, s;
+
+  for (i = 0; i < BASE_NUM; i++) {
+    if ((i == BASE_M3) || (i == BASE_SPIFI) || (CGU_BASE_CLK(i) & 1)) {
+      continue;                              /* ours or powered down */
+    }
+    s = (CGU_BASE_CLK(i) >> 24) & 0x1F;
+    if (s == src) {
+      return (1);
+    }
+    if ((s >= CLK_IDIVA) && (s < CLK_IDIVA + IDIV_NUM) &&
+        !(CGU_IDIV_CTRL(s - CLK_IDIVA) & 1) &&
+        (((CGU_IDIV_CTRL(s - CLK_IDIVA) >> 24) & 0x1F) == src)) {
+      return (1);                            /* through a divider */
+    }
+  }
+
+  return (0);
+}
+
+
+/*  Restore the clock tree saved by ClockSave
+ *  The base clocks run from the IRC while PLL1 and the SPIFI divider get
+ *  back their settings, so they are never fed by a PLL that is not
+ *  locked. A core clock from PLL1 is ramped up through PLL1 / 2 for
+ *  50 us, as needed above 110 MHz.
+ */
+
+void ClockRestore (void) {
+  uint32_t tmo, t;
+
+  if (!clkSaved) {
+    return;
+  }
+
+  CGU_BASE_SPIFI0_CLK = (CLK_IRC << 24) | (1 << 11);
+  if (clkChanged) {
+    CGU_BASE_M3_CLK = (CLK_IRC << 24) | (1 << 11);
+    CGU_PLL1_CTRL   = savePll1;
+    if ((savePll1 & 3) == 0) {               /* enabled and not bypassed */
+      for (tmo = PLL_LOCK_TMO; tmo && !(CGU_PLL1_STAT & 1); tmo--);
+    }
+    if (((saveBaseM3 >> 24) & 0x1F) == CLK_PLL1) {
+      CGU_IDIV_CTRL(spifiDiv) = (CLK_PLL1 << 24) | (1 << 11) | (1 << 2);  /* PLL1 / 2 */
+      CGU_BASE_M3_CLK = ((CLK_IDIVA + spifiDiv) << 24) | (1 << 11);
+      for (t = DWT_CYCCNT; (DWT_CYCCNT - t) < RAMP_CYCLES; );
+    }
+    CGU_IDIV_CTRL(spifiDiv) = saveDiv;
+    CGU_BASE_M3_CLK = saveBaseM3;
+    clkChanged = 0;
+  }
+  CGU_BASE_SPIFI0_CLK = saveBaseSpifi;
+  clkSaved = 0;
+}
+
+
+/*  Run the core from PLL1 and SPIFI from a divider (PLL1 / 1..4)
+ *  The core clock is clk (multiple of 12 MHz, CORE_DEF if clk is not
+ *  above the IRC, CORE_MAX at most). The SPIFI clock is the fastest
+ *  one within the device limits for program and read in the I/O mode
+ *  used. SPIFI takes the first of IDIVA..IDIVE that feeds no other base
+ *  clock. Everything stays on the IRC without limits, PLL1 lock or a
+ *  free divider, or if PLL1 feeds other base clocks.
+ *    Parameter:      clk:  Clock Frequency (Hz) passed to Init
+ */
+
+void ClockSetup (unsigned long clk) {
+  uint32_t core, lim, val, m, p, d, tmo, i;
+
+  coreClock  = IRC_CLOCK;
+  spifiClock = IRC_CLOCK;
+  if (!HS_CLOCK) {
+    return;
+  }
+
+  core = (clk > IRC_CLOCK) ? clk : CORE_DEF;
+  if (core > CORE_MAX) {
+    core = CORE_MAX;
+  }
+  m = core / IRC_CLOCK;
+  if (m < 2) {
+    return;                                  /* IRC is fast enough */
+  }
+  core = m * IRC_CLOCK;
+
+  if (spifiMode == 4) {
+    lim = spifiDevGetInfo(pSpifi, SPIFI_INFO_MAX_QUADPROG_CLOCK);
+    val = spifiDevGetInfo(pSpifi, SPIFI_INFO_MAX_QUADREAD_CLOCK);
+  } else {
+    lim = spifiDevGetInfo(pSpifi, SPIFI_INFO_MAX_PROG_CLOCK);
+    val = spifiDevGetInfo(pSpifi, SPIFI_INFO_MAX_READ_CLOCK);
+  }
+  if ((val != 0) && ((lim == 0) || (val < lim))) {
+    lim = val;
+  }
+  if (lim == 0) {
+    lim = spifiDevGetInfo(pSpifi, SPIFI_INFO_MAXCLOCK);
+  }
+  if (lim < IRC_CLOCK) {
+    return;                                  /* no usable limit reported */
+  }
+  if (ClockUsed(CLK_PLL1)) {
+    return;                                  /* PLL1 in use by the application */
+  }
+  for (i = 0; (i < IDIV_NUM) && ClockUsed(CLK_IDIVA + i); i++);
+  if (i == IDIV_NUM) {
+    return;                                  /* no free divider for SPIFI */
+  }
+  spifiDiv   = i;
+  saveDiv    = CGU_IDIV_CTRL(i);
+  clkChanged = 1;
+
+  for (p = 0; (p < 3) && (core * (2 << p) < 156000000); p++);  /* CCO 156..320 MHz */
+
+  CGU_BASE_M3_CLK     = (CLK_IRC << 24) | (1 << 11);
+  CGU_BASE_SPIFI0_CLK = (CLK_IRC << 24) | (1 << 11);
+  CGU_PLL1_CTRL = (CLK_IRC << 24) | (1 << 11) | 1;            /* power down */
+  CGU_PLL1_CTRL = (CLK_IRC << 24) | ((m - 1) << 16) | (1 << 11) | (p << 8) | (1 << 6);
+  for (tmo = PLL_LOCK_TMO; tmo && !(CGU_PLL1_STAT & 1); tmo--);
+  if (tmo == 0) {
+    return;                                  /* not locked, stay on IRC */
+  }
+
+  for (d = 1; (d < 4) && (core / d > lim); d++);
+  if (core / d > lim) {
+    d = 0;                                   /* SPIFI stays on IRC */
+  }
+
+  CGU_BASE_M3_CLK = (CLK_PLL1 << 24) | (1 << 11);
+  coreClock = core;
+  if (d != 0) {
+    CGU_IDIV_CTRL(spifiDiv) = (CLK_PLL1 << 24) | (1 << 11) | ((d - 1) << 2);
+    CGU_BASE_SPIFI0_CLK     = ((CLK_IDIVA + spifiDiv) << 24) | (1 << 11);
+    spifiClock = core / d;
+  }
+}
+
+
+/*  Wait until a non-blocking program/erase has completed
+ *  A program or erase error, or a busy device after busyTmo ms (DWT
+ *  cycle counter), is kept in deferErr (failAdr) for WaitReady.
+ */
+
+void WaitDone (void) {
+  uint32_t stat, st, t, ms;
+
+  if (!devBusy) {
+    return;
+  }
+  stat = 0;
+  ms   = 0;
+  t    = DWT_CYCCNT;
+  do {
+    st    = spifiDevGetInfo(pSpifi, SPIFI_INFO_STATUS);
+    stat |= st;                              /* error bits are cleared on read */
+    if ((DWT_CYCCNT - t) >= coreClock / 1000) {
+      t += coreClock / 1000;                 /* counted per ms: no wrap */
+      if (++ms > busyTmo) {
+        break;                               /* timeout: still busy */
+      }
+    }
+  } while (st & SPIFI_STAT_BUSY);
+  devBusy = 0;
+
+  if ((st & SPIFI_STAT_BUSY) ||
+      (stat & (SPIFI_STAT_PROGERR | SPIFI_STAT_ERASEERR))) {
+    failAdr  = busyAdr;
+    deferErr = 1;
+  }
+}
+
+
+/*  Wait for the pending operation and report its deferred error
  *    Return Value:   0 - OK,  1 - Failed
  */
 
-int Init (unsigned long adr, unsigned long clk, unsigned long fnc) {
-  SPIFI_ERR_T errCode;
+int WaitReady (void) {
 
-  base_adr = adr;
+  WaitDone();
+  if (deferErr) {
+    deferErr = 0;
+    return (1);
+  }
 
-  __cpp_initialize__aeabi_();	
-	
-  /* init SPIFI clock and pins */
-  CGU_BASE_SPIFI0_CLK = 1<<24 | 1<<11; /* IRC 12 MHz is good enough for us */
+  return (0);
+}
 
-  /* set up SPIFI I/O (undocumented bit 7 set as 1, Aug 2 2011) */
-  SCU_SFSP3_3 = 0xF3; /* high drive for SCLK */
-  /* IO pins */
-  SCU_SFSP3_4 =
-  SCU_SFSP3_5 =
-  SCU_SFSP3_6 =
-  SCU_SFSP3_7 = 0xD3;
-  SCU_SFSP3_8 = 0x13; /* CS doesn't need feedback */
+
+/*  Command issued: completion is checked by the next call in
+ *  non-blocking mode
+ *    Parameter:      adr:  Address of the operation
+ *                    tmo:  Timeout (ms)
+ */
+
+void Issued (unsigned long adr, unsigned long tmo) {
+
+  devBusy = noBlock;
+  busyAdr = adr;
+  busyTmo = tmo;
+}
+
+
+/*  Switch between memory mode and command mode
+ *  Switches are counted and timed (DWT cycle counter): without a session
+ *  every erase/program operation costs two, so the overhead saved per
+ *  operation is modeCycles / modeSwitches * (2 - modeSwitches / cmdOps).
+ *    Parameter:      on:   1 - Memory Mode,  0 - Command Mode
+ */
+
+void SetMemMode (uint32_t on) {
+  uint32_t t;
+
+  if (memMode == on) {
+    return;
+  }
+  if (on) {
+    WaitDone();                              /* no reads while device is busy */
+  }
+  t = DWT_CYCCNT;
+  spifiDevSetMemMode(pSpifi, on);
+  modeCycles += DWT_CYCCNT - t;
+  modeSwitches++;
+  memMode = on;
+}
+
+
+/*  Command mode for an erase or program operation
+ */
+
+void CmdMode (void) {
+
+  cmdOps++;
+  SetMemMode(0);
+}
+
+
+/*  End of an erase or program operation: back to memory mode unless a
+ *  command mode session lasts for the whole erase or program phase
+ *  (without a session a non-blocking operation is waited for here)
+ */
+
+void CmdDone (void) {
+
+  if (!CMD_SESSION) {
+    SetMemMode(1);
+  }
+}
+
+
+/*  Detect the device and set up the handle (full initialization)
+ *  The handle cache is CACHE_USED afterwards, UnInit stores it.
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+int DetectDevice (void) {
+  SPIFI_ERR_T errCode;
+
+  __cpp_initialize__aeabi_();
 
   /* Initialize LPCSPIFILIB library, reset the interface */
   errCode = spifiInit(SPIFI_BASE, true);
@@ -94,6 +561,9 @@ int Init (unsigned long adr, unsigned long clk, unsigned long fnc) {
   /* register support for the family(s) we may want to work with */
   //  spifiRegisterFamily(SPIFI_REG_FAMILY_Spansion_2Byte_PStatus);
   spifiRegisterFamily(spifi_REG_FAMILY_CommonCommandSet);
+#ifdef SPIFI_DRV_OPEN
+  spifiRegisterFamily(spifi_REG_FAMILY_SFDP);  /* tried first: SFDP parameters */
+#endif
 
   /* Get required memory for detected device, this may vary per device family */
   memSize = spifiGetHandleMemSize(SPIFI_BASE);
@@ -110,7 +580,102 @@ int Init (unsigned long adr, unsigned long clk, unsigned long fnc) {
     return(1);
   }
 
-  spifiDevSetMemMode(pSpifi, true);          /* Enter memMode */
+  hCache.adr = base_adr;
+  hCache.id  = ReadJedecId();                /* compared by HandleReuse */
+  hCache.sig = CACHE_USED;
+
+  return (0);
+}
+
+
+/*  Restore DEMCR.TRCENA and DWT_CTRL.CYCCNTENA as found by Init, after
+ *  ClockRestore (it times the clock ramp with the cycle counter)
+ */
+
+void DwtRestore (void) {
+  DWT_CTRL = (DWT_CTRL & ~1UL) | (saveDwtCtrl & 1);
+  DEMCR    = (DEMCR & ~(1UL << 24)) | (saveDemcr & (1UL << 24));
+}
+
+
+/*  Initialize Flash Programming Functions
+ *  Device detection is skipped while the handle stored by the last
+ *  UnInit is still valid (HandleReuse).
+ *    Parameter:      adr:  Device Base Address
+ *                    clk:  Clock Frequency (Hz)
+ *                    fnc:  Function Code (1 - Erase, 2 - Program, 3 - Verify)
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+int Init (unsigned long adr, unsigned long clk, unsigned long fnc) {
+  uint32_t t;
+
+  base_adr     = adr;
+  skipCnt      = 0;
+  eraseSkipCnt = 0;
+  cmdOps       = 0;
+  modeSwitches = 0;
+  modeCycles   = 0;
+  noBlock      = 0;
+  devBusy      = 0;
+  deferErr     = 0;
+
+  saveDemcr   = DEMCR;                       /* restored by UnInit */
+  saveDwtCtrl = DWT_CTRL;
+  DEMCR    |= 1 << 24;                       /* enable DWT cycle counter */
+  DWT_CTRL |= 1;
+  t = DWT_CYCCNT;
+
+  ClockSave();                               /* restored by UnInit */
+
+  /* init SPIFI clock and pins */
+  CGU_BASE_SPIFI0_CLK = 1<<24 | 1<<11; /* IRC 12 MHz is good enough for us */
+
+  /* set up SPIFI I/O (undocumented bit 7 set as 1, Aug 2 2011) */
+  SCU_SFSP3_3 = 0xF3; /* high drive for SCLK */
+  /* IO pins */
+  SCU_SFSP3_4 =
+  SCU_SFSP3_5 =
+  SCU_SFSP3_6 =
+  SCU_SFSP3_7 = 0xD3;
+  SCU_SFSP3_8 = 0x13; /* CS doesn't need feedback */
+
+  if (!HandleReuse(adr)) {                   /* device detected by an earlier Init */
+    if (DetectDevice() != 0) {
+      ClockRestore();
+      DwtRestore();
+      return (1);
+    }
+  }
+
+  if (SUBBLK_ERASE &&                        /* 4 KB sectors: never erase more */
+      (!(spifiDevGetInfo(pSpifi, SPIFI_INFO_CAPS) & SPIFI_CAP_SUBBLKERASE) ||
+       (spifiDevGetInfo(pSpifi, SPIFI_INFO_ERASE_SUBBLOCKSIZE) != SECTOR_SIZE))) {
+    ClockRestore();
+    DwtRestore();
+    return (1);
+  }
+  if (!SUBBLK_ERASE &&                       /* block sectors must match the device */
+      (spifiDevGetInfo(pSpifi, SPIFI_INFO_ERASE_BLOCKSIZE) != SECTOR_SIZE)) {
+    ClockRestore();
+    DwtRestore();
+    return (1);
+  }
+
+  SetQuadMode();                             /* program and memMode reads */
+  ClockSetup(clk);                           /* limits depend on I/O mode */
+
+  if (NO_BLOCK && (fnc != 3) &&
+      (spifiDevGetInfo(pSpifi, SPIFI_INFO_CAPS) & SPIFI_CAP_NOBLOCK) &&
+      (spifiDevSetOpts(pSpifi, SPIFI_OPT_NOBLOCK, true) == SPIFI_ERR_NONE)) {
+    noBlock = 1;                             /* poll status on next call */
+  }
+
+  memMode = 0;                               /* command mode after init */
+  if (!CMD_SESSION || (fnc == 3)) {
+    SetMemMode(1);                           /* Enter memMode */
+  }
+  initCycles = DWT_CYCCNT - t;
 
   return 0;                                  /* Finished without Errors */
 }
@@ -122,23 +687,47 @@ int Init (unsigned long adr, unsigned long clk, unsigned long fnc) {
  */
 
 int UnInit (unsigned long fnc) {
+  int err;
+
+  err = WaitReady();                         /* last non-blocking operation */
+  if (noBlock) {
+    spifiDevSetOpts(pSpifi, SPIFI_OPT_NOBLOCK, false);
+  }
 
   /* Done, de-init will enter memory mode */
   spifiDevDeInit(pSpifi);
+  memMode = 1;
+#ifdef SPIFI_DRV_OPEN
+  spifiDeInit();                             /* GPDMA as before Init */
+#endif
+  if (hCache.sig == CACHE_USED) {            /* keep the handle for the next Init */
+    hCache.ctrl = SPIFI_CTRL;
+    hCache.sum  = HandleSum();
+    hCache.sig  = CACHE_SIG;
+  }
+  ClockRestore();                            /* application clock tree */
+  DwtRestore();                              /* debugger's trace settings */
   
-  return 0;                                  // Finished without Errors
+  return (err);
 }
 
 
-/*  Erase complete Flash Memory
+/*  Erase complete Flash Memory (device bulk erase command)
  *    Return Value:   0 - OK,  1 - Failed */
 
 int EraseChip (void) {
   SPIFI_ERR_T errCode;
   
-  spifiDevSetMemMode(pSpifi, false);         /* Leave memMode */
-  errCode = spifiErase(pSpifi, 0, spifiDevGetInfo(pSpifi, SPIFI_INFO_ERASE_BLOCKS));
-  spifiDevSetMemMode(pSpifi, true);          /* Enter memMode */
+  if (WaitReady()) {
+    return (1);                              /* previous operation failed */
+  }
+  CmdMode();
+  errCode = spifiDevEraseAll(pSpifi);
+  if (errCode == SPIFI_ERR_NONE) {
+    Issued(base_adr, TO_ERASE *
+           spifiDevGetInfo(pSpifi, SPIFI_INFO_ERASE_BLOCKS));
+  }
+  CmdDone();
   if (errCode != SPIFI_ERR_NONE) {
     return(1);
   }
@@ -147,7 +736,80 @@ int EraseChip (void) {
 }
 
 
+/*  Fast Blank Scan through the memory mapped SPIFI window, or with
+ *  command mode reads while a command mode session is active
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes, multiple of 4)
+ *    Return Value:   1 - Blank,  0 - Not Blank
+ */
+
+int SectorBlank (unsigned long adr, unsigned long sz) {
+  volatile uint32_t *p = (volatile uint32_t *)adr;
+  uint32_t           i, n;
+
+  if (!memMode) {
+    for ( ; sz > 0; sz -= n, adr += n) {
+      n = (sz < SCAN_SIZE) ? sz : SCAN_SIZE;
+      if (spifiRead(pSpifi, (uint32_t)adr, scanBuf, n) != SPIFI_ERR_NONE) {
+        return (0);
+      }
+      for (i = 0; i < n / 4; i++) {
+        if (scanBuf[i] != 0xFFFFFFFF) {
+          return (0);
+        }
+      }
+    }
+    return (1);
+  }
+
+  for ( ; sz > 0; sz -= 4) {
+    if (*p++ != 0xFFFFFFFF) {
+      return (0);
+    }
+  }
+
+  return (1);
+}
+
+
+/*  Erase 4 KB Sub-Block in Flash Memory
+ *    Parameter:      adr:  Sub-Block Address
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+int EraseSubBlock (unsigned long adr) {
+  SPIFI_ERR_T errCode;
+  uint32_t    subNr;
+
+  subNr = spifiGetSubBlockFromAddr(pSpifi, (uint32_t)adr);
+  if (subNr == 0xFFFFFFFF) {
+    return(1);
+  }
+
+  if (ERASE_SKIP &&                          /* scan sub-block before erase */
+      SectorBlank(spifiGetAddrFromSubBlock(pSpifi, subNr),
+                  spifiDevGetInfo(pSpifi, SPIFI_INFO_ERASE_SUBBLOCKSIZE))) {
+    eraseSkipCnt++;
+    return (0);
+  }
+
+  CmdMode();
+  errCode = spifiDevEraseSubBlock(pSpifi, subNr);
+  if (errCode == SPIFI_ERR_NONE) {
+    Issued(adr, TO_ERASE);
+  }
+  CmdDone();
+  if (errCode != SPIFI_ERR_NONE) {
+    return(1);
+  }
+
+  return (0);
+}
+
+
 /*  Erase Sector in Flash Memory
+ *  With 4 KB sectors (SUBBLK_4K) the sub-block is erased, Init fails
+ *  for devices without sub-block erase.
  *    Parameter:      adr:  Sector Address
  *    Return Value:   0 - OK,  1 - Failed
  */
@@ -156,14 +818,32 @@ int EraseSector (unsigned long adr) {
   SPIFI_ERR_T errCode;
   uint32_t    blockNr;
 
+  if (WaitReady()) {
+    return (1);                              /* previous operation failed */
+  }
+
+  if (SUBBLK_ERASE) {
+    return (EraseSubBlock(adr));
+  }
+
   blockNr = spifiGetBlockFromAddr(pSpifi, (uint32_t)adr);
   if (blockNr == 0xFFFFFFFF) {
     return(1);
   }
 
-  spifiDevSetMemMode(pSpifi, false);         /* Leave memMode */
+  if (ERASE_SKIP &&                          /* scan block before erase */
+      SectorBlank(spifiGetAddrFromBlock(pSpifi, blockNr),
+                  spifiDevGetInfo(pSpifi, SPIFI_INFO_ERASE_BLOCKSIZE))) {
+    eraseSkipCnt++;
+    return (0);
+  }
+
+  CmdMode();
   errCode = spifiErase(pSpifi, blockNr, 1);
-  spifiDevSetMemMode(pSpifi, true);          /* Enter memMode */
+  if (errCode == SPIFI_ERR_NONE) {
+    Issued(adr, TO_ERASE);
+  }
+  CmdDone();
   if (errCode != SPIFI_ERR_NONE) {
     return(1);
   }
@@ -172,6 +852,31 @@ int EraseSector (unsigned long adr) {
 }
 
 
+/*  Check if Data equals the Erased Value
+ *    Parameter:      buf:  Data
+ *                    sz:   Size in Bytes
+ *    Return Value:   1 - Erased,  0 - Not Erased
+ */
+
+int IsEmpty (unsigned char *buf, unsigned long sz) {
+  uint32_t *p = (uint32_t *)buf;
+
+  for ( ; sz >= 4; sz -= 4) {
+    if (*p++ != 0xFFFFFFFF) {
+      return (0);
+    }
+  }
+  buf = (unsigned char *)p;
+  for ( ; sz > 0; sz--) {
+    if (*buf++ != 0xFF) {
+      return (0);
+    }
+  }
+
+  return (1);
+}
+
+
 /*  Program Page in Flash Memory
  *    Parameter:      adr:  Page Start Address
  *                    sz:   Page Size
@@ -180,14 +885,270 @@ int EraseSector (unsigned long adr) {
  */
 
 int ProgramPage (unsigned long adr, unsigned long sz, unsigned char *buf) {
-  SPIFI_ERR_T errCode;
+  SPIFI_ERR_T errCode = SPIFI_ERR_NONE;
+  uint32_t    pageSize, n;
+  bool        cmd = false;
+
+  if (WaitReady()) {
+    return (1);                              /* previous page failed */
+  }
+
+  pageSize = spifiDevGetInfo(pSpifi, SPIFI_INFO_PAGESIZE);
 
-  spifiDevSetMemMode(pSpifi, false);         /* Leave memMode */
-  errCode = spifiProgram(pSpifi, (uint32_t)adr, (uint32_t *)buf, sz);
-  spifiDevSetMemMode(pSpifi, true);          /* Enter memMode */
+  while (sz > 0) {
+    n = pageSize - (adr & (pageSize - 1));   /* bytes up to device page end */
+    if (n > sz) {
+      n = sz;
+    }
+    if (SKIP_EMPTY && IsEmpty(buf, n)) {
+      skipCnt++;                             /* nothing to program */
+    } else {
+      if (!cmd) {
+        CmdMode();
+        cmd = true;
+      }
+      if (WaitReady()) {                     /* previous device page */
+        errCode = SPIFI_ERR_PROGERR;
+        break;
+      }
+      errCode = spifiProgram(pSpifi, (uint32_t)adr, (uint32_t *)buf, n);
+      if (errCode != SPIFI_ERR_NONE) {
+        break;
+      }
+      Issued(adr, TO_PROG);
+    }
+    adr += n;
+    buf += n;
+    sz  -= n;
+  }
+
+  if (cmd) {
+    CmdDone();
+  }
   if (errCode != SPIFI_ERR_NONE) {
     return (1);
   }
 
   return (0);
 }
+
+
+/*  Program Pages from the Double Buffer until the host sends size 0
+ *  (handshake: FlashDblBuf.H). In non-blocking mode an error shows up one
+ *  page later, failAdr holds the address of the page that failed.
+ *    Return Value:   0 - OK,  1 - Failed or host timeout (dBufStat = 2)
+ */
+
+int ProgramPages (void) {
+  DBUF_T   *b;
+  uint32_t  i, t;
+
+  dBufStat = 0;
+  for (i = 0; ; i ^= 1) {
+    b = &dBuf[i];
+    t = DWT_CYCCNT;
+    while (b->state != DB_FULL) {            /* wait for host */
+      if ((DWT_CYCCNT - t) > (coreClock / 1000) * DB_WAIT_MS) {
+        dBufStat = 2;
+        return (1);
+      }
+    }
+    if (b->sz == 0) {
+      break;                                 /* end of data */
+    }
+    if (ProgramPage(b->adr, b->sz, b->data) != 0) {
+      dBufStat = 2;
+      return (1);
+    }
+    b->state = DB_EMPTY;
+  }
+  if (WaitReady()) {                         /* last page */
+    dBufStat = 2;
+    return (1);
+  }
+  b->state = DB_EMPTY;
+  dBufStat = 1;
+
+  return (0);
+}
+
+
+/*  Blank Check through the memory mapped SPIFI window (quad read if
+ *  enabled), word-wide with early exit
+ *    Parameter:      adr:  Block Start Address
+ *                    sz:   Block Size (in bytes)
+ *                    pat:  Block Pattern
+ *    Return Value:   0 - OK,  1 - Failed (blankFailAdr: first failing address)
+ */
+
+int BlankCheck (unsigned long adr, unsigned long sz, unsigned char pat) {
+  uint32_t pat32 = pat * 0x01010101;
+
+  SetMemMode(1);                             /* ends a command mode session */
+
+  for ( ; (sz > 0) && ((adr & 3) != 0); sz--, adr++) {
+    if (*(volatile uint8_t *)adr != pat) {
+      blankFailAdr = adr;
+      return (1);
+    }
+  }
+  for ( ; sz >= 4; sz -= 4, adr += 4) {
+    if (*(volatile uint32_t *)adr != pat32) {
+      break;                                 /* locate byte below */
+    }
+  }
+  for ( ; sz > 0; sz--, adr++) {
+    if (*(volatile uint8_t *)adr != pat) {
+      blankFailAdr = adr;
+      return (1);
+    }
+  }
+
+  return (0);
+}
+
+
+/*  Verify Flash Contents through the memory mapped SPIFI window (quad
+ *  read if enabled), word-wide when the buffer is aligned like the
+ *  address, with early exit
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes)
+ *                    buf:  Data
+ *    Return Value:   (adr+sz) - OK, Failed Address
+ */
+
+unsigned long Verify (unsigned long adr, unsigned long sz, unsigned char *buf) {
+
+  SetMemMode(1);                             /* ends a command mode session */
+
+  for ( ; (sz > 0) && ((adr & 3) != 0); sz--, adr++, buf++) {
+    if (*(volatile uint8_t *)adr != *buf) {
+      return (adr);
+    }
+  }
+  if ((((unsigned long)buf) & 3) == 0) {     /* buffer aligned like address */
+    for ( ; sz >= 4; sz -= 4, adr += 4, buf += 4) {
+      if (*(volatile uint32_t *)adr != *(uint32_t *)buf) {
+        break;                               /* locate byte below */
+      }
+    }
+  }
+  for ( ; sz > 0; sz--, adr++, buf++) {
+    if (*(volatile uint8_t *)adr != *buf) {
+      break;
+    }
+  }
+
+  return (adr);
+}
+
+
+/*  Build CRC32 Lookup Table (reflected polynomial 0xEDB88320)
+ */
+
+void CrcInit (void) {
+  uint32_t c;
+  int      i, j;
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (j = 0; j < 8; j++) {
+      c = (c & 1) ? ((c >> 1) ^ 0xEDB88320) : (c >> 1);
+    }
+    crcTab[i] = c;
+  }
+}
+
+
+/*  Calculate CRC32 of Flash Contents (same as zlib crc32)
+ *    Parameter:      adr:  Start Address
+ *                    sz:   Size (in bytes)
+ *    Return Value:   CRC32 Value
+ */
+
+unsigned long Crc32 (unsigned long adr, unsigned long sz) {
+  volatile uint8_t  *p8  = (volatile uint8_t *)adr;
+  volatile uint32_t *p32;
+  uint32_t           crc = 0xFFFFFFFF;
+
+  if (crcTab[255] != 0x2D02EF8D) {           /* table not built yet */
+    CrcInit();
+  }
+  SetMemMode(1);                             /* ends a command mode session */
+
+  for ( ; (sz > 0) && ((adr & 3) != 0); sz--, adr++) {
+    crc = crcTab[(crc ^ *p8++) & 0xFF] ^ (crc >> 8);
+  }
+  p32 = (volatile uint32_t *)p8;
+  for ( ; sz >= 4; sz -= 4) {                /* one 32-bit read per 4 bytes */
+    crc ^= *p32++;
+    crc  = crcTab[crc & 0xFF] ^ (crc >> 8);
+    crc  = crcTab[crc & 0xFF] ^ (crc >> 8);
+    crc  = crcTab[crc & 0xFF] ^ (crc >> 8);
+    crc  = crcTab[crc & 0xFF] ^ (crc >> 8);
+  }
+  p8 = (volatile uint8_t *)p32;
+  for ( ; sz > 0; sz--) {
+    crc = crcTab[(crc ^ *p8++) & 0xFF] ^ (crc >> 8);
+  }
+
+  return (crc ^ 0xFFFFFFFF);
+}
+
+
+/*  Run a command queue (FlashQueue.H); each erase or program entry is
+ *  waited for, so a non-blocking error is reported by its own entry
+ *    Parameter:      cmd:  List of operations
+ *                    n:    Number of operations
+ *                    buf:  Program data (CQ_PROGRAM: buf + ofs)
+ *                    len:  Size of buf (in bytes)
+ *                    stat: Status per operation (CQ_OK, ...)
+ *    Return Value:   0 - OK,  1 - Failed
+ */
+
+int RunQueue (struct fcmd *cmd, unsigned long n, unsigned char *buf, unsigned long len,
+              unsigned long *stat) {
+  uint32_t i, w;
+  int      r, err = 0, stop = 0;
+
+  for (i = 0; i < n; i++, cmd++) {
+    if (stop) {
+      stat[i] = CQ_SKIPPED;
+      continue;
+    }
+    switch (cmd->op) {
+      case CQ_ERASE:
+        r = EraseSector(cmd->adr) || WaitReady();
+        stop = r;
+        break;
+      case CQ_PROGRAM:
+        w = len & ~3;                        /* whole words in buf */
+        if ((cmd->ofs & 3) || (cmd->ofs > w) || (cmd->sz > w - cmd->ofs)) {
+          stat[i] = CQ_BADARG;               /* data outside buf or unaligned */
+          err = stop = 1;
+          continue;
+        }
+        r = ProgramPage(cmd->adr, cmd->sz, buf + cmd->ofs) || WaitReady();
+        stop = r;
+        break;
+      case CQ_BLANK:
+        r = BlankCheck(cmd->adr, cmd->sz, 0xFF);
+        cmd->res = r ? blankFailAdr : 0;
+        break;
+      case CQ_CRC:
+        cmd->res = Crc32(cmd->adr, cmd->sz);
+        r = 0;
+        break;
+      default:
+        stat[i] = CQ_BADOP;
+        err = 1;
+        continue;
+    }
+    stat[i] = r ? CQ_FAILED : CQ_OK;
+    if (r) {
+      err = 1;
+    }
+  }
+
+  return (err);
+}
@@ -0,0 +1,1545 @@
+/* -----------------------------------------------------------------------------
+ * Copyright (c) 2014 ARM Ltd.
+ *
+ * This software is provided 'as-is', without any express or implied warranty.
+ * In no event will the authors be held liable for any damages arising from
+ * the use of this software. Permission is granted to anyone to use this
+ * software for any purpose, including commercial applications, and to alter
+ * it and redistribute it freely, subject to the following restrictions:
+ *
+ * 1. The origin of this software must not be misrepresented; you must not
+ *    claim that you wrote the original software. If you use this software in
+ *    a product, an acknowledgment in the product documentation would be
+ *    appreciated but is not required.
+ *
+ * 2. Altered source versions must be plainly marked as such, and must not be
+ *    misrepresented as being the original software.
+ *
+ * 3. This notice may not be removed or altered from any source distribution.
+ *
+ *
+ * $Date:        04. September 2014
+ * $Revision:    V1.00
+ *
+ * Project:      Open SPIFI Driver (register level, command mode) for
+ *               NXP LPC18xx/LPC43xx SPIFI Flash
+ * --------------------------------------------------------------------------- */
+
+/* Replaces lib_lpcspifi_M3_PI.lib for the calls made by FlashPrg.c, with the
+ * same API (spifilib_api.h). Build option: define SPIFI_DRV_OPEN in the
+ * project (C/C++ Defines) to use this driver, without it the file is empty
+ * and the binary library is linked. No library member is pulled in while
+ * this driver defines all symbols used, so the library can stay in the
+ * project for benchmarking one against the other.
+ *
+ * Page program data goes to the SPIFI data FIFO through GPDMA channel 0
+ * (SPIFI DMA request) if the buffer is word aligned, otherwise by CPU.
+ * The first DMA page saves and sets up the GPDMA clock, enable and
+ * request mux, spifiDeInit restores them.
+ * The algorithm is position independent (ROPI/RWPI): data tables hold no
+ * pointers, the family structures are set up at run time.
+ *
+ * Two families: the common command set (devTab, by JEDEC ID) and SFDP
+ * (JESD216 parameter table: density, erase types, read modes, quad
+ * enable method), which covers S25FL, MX25L and similar parts.
+ *
+ * Devices above 16 MB (S25FL256S, S25FL512S) use the 4-byte address
+ * opcodes (frame with 4 address bytes) for read, memory mode, program and
+ * erase. The memory mapped window limits the device size to 64 MB.
+ */
+
+#ifdef SPIFI_DRV_OPEN
+
+#include <stdbool.h>
+#include "spifilib_api.h"
+
+
+#define SPIFI_CTRL              (*(volatile uint32_t *)(ctrlBase + 0x00))
+#define SPIFI_CMD               (*(volatile uint32_t *)(ctrlBase + 0x04))
+#define SPIFI_ADDR              (*(volatile uint32_t *)(ctrlBase + 0x08))
+#define SPIFI_IDATA             (*(volatile uint32_t *)(ctrlBase + 0x0C))
+#define SPIFI_DATA              (*(volatile uint32_t *)(ctrlBase + 0x14))
+#define SPIFI_DATA8             (*(volatile uint8_t  *)(ctrlBase + 0x14))
+#define SPIFI_MCMD              (*(volatile uint32_t *)(ctrlBase + 0x18))
+#define SPIFI_STAT              (*(volatile uint32_t *)(ctrlBase + 0x1C))
+
+#define GPDMA_INTTCCLEAR        (*(volatile uint32_t *)0x40002008)
+#define GPDMA_INTERRCLR         (*(volatile uint32_t *)0x40002010)
+#define GPDMA_RAWINTTCSTAT      (*(volatile uint32_t *)0x40002014)
+#define GPDMA_RAWINTERRSTAT     (*(volatile uint32_t *)0x40002018)
+#define GPDMA_CONFIG            (*(volatile uint32_t *)0x40002030)
+#define GPDMA_C0SRCADDR         (*(volatile uint32_t *)0x40002100)
+#define GPDMA_C0DESTADDR        (*(volatile uint32_t *)0x40002104)
+#define GPDMA_C0LLI             (*(volatile uint32_t *)0x40002108)
+#define GPDMA_C0CONTROL         (*(volatile uint32_t *)0x4000210C)
+#define GPDMA_C0CONFIG          (*(volatile uint32_t *)0x40002110)
+#define CCU1_CLK_M3_DMA_CFG     (*(volatile uint32_t *)0x40051440)
+#define CREG_DMAMUX             (*(volatile uint32_t *)0x4004311C)
+
+#define SPIFI_DMA               1   /* Page program data through GPDMA (0 - CPU writes) */
+#define DMA_TMO           1000000   /* GPDMA transfer timeout (poll iterations) */
+#define DRV_VERSION        0x0100   /* Reported by spifiGetLibVersion */
+#define SFDP_CLOCK       50000000   /* Clock limit of SFDP devices not in devTab */
+#define SFDP_DWORDS            16   /* Basic parameter table DWORDs used */
+#define ADDR3_MAX       0x1000000   /* 3-byte address range (16 MB) */
+#define MEM_WINDOW      0x4000000   /* Memory mapped window (64 MB) */
+
+#define STAT_MCINIT          0x01   /* SPIFI_STAT: memory mode */
+#define STAT_CMD             0x02   /* SPIFI_STAT: command active */
+#define STAT_RESET           0x10   /* SPIFI_STAT: abort command / memory mode */
+#define CTRL_DEF   (0xFFFF | (15 << 16) | (1UL << 30))  /* timeout, CS high, FBCLK */
+#define CTRL_DMAEN      (1UL << 31) /* SPIFI_CTRL: DMA request enable */
+
+#define CMD_OP(op)  ((uint32_t)(op) << 24)  /* opcode */
+#define FRAME_OP        (1 << 21)   /* frame: opcode only */
+#define FRAME_OP_A3     (4 << 21)   /* frame: opcode, 3 address bytes */
+#define FRAME_OP_A4     (5 << 21)   /* frame: opcode, 4 address bytes */
+#define FIELD_QDATA     (1 << 19)   /* data field quad, opcode and address serial */
+#define FIELD_QADDR     (2 << 19)   /* address, intermediate and data quad */
+#define CMD_INTLEN(n)   ((n) << 16) /* intermediate (dummy) bytes */
+#define CMD_DOUT        (1 << 15)   /* data to the device */
+#define CMD_POLL        (1 << 14)   /* poll status bit (DATALEN[2:0], value DATALEN[3]) */
+#define CMD_LEN_MAX        0x3FFF   /* DATALEN field */
+
+#define OP_WRR               0x01   /* Write Registers (status, configuration) */
+#define OP_PP                0x02   /* Page Program */
+#define OP_RDSR              0x05   /* Read Status Register */
+#define OP_WREN              0x06   /* Write Enable */
+#define OP_FAST_READ         0x0B   /* Fast Read (1 dummy byte) */
+#define OP_4FAST_READ        0x0C   /* Fast Read, 4-byte address */
+#define OP_4PP               0x12   /* Page Program, 4-byte address */
+#define OP_P4E               0x20   /* 4 KB Sub-Block Erase */
+#define OP_4P4E              0x21   /* 4 KB Sub-Block Erase, 4-byte address */
+#define OP_CLSR              0x30   /* Clear Status Register (error bits) */
+#define OP_WRSR2             0x31   /* Write Status Register 2 */
+#define OP_QPP               0x32   /* Quad Page Program */
+#define OP_4QPP              0x34   /* Quad Page Program, 4-byte address */
+#define OP_RCR               0x35   /* Read Configuration Register (Status Register 2) */
+#define OP_WRSR2_3E          0x3E   /* Write Status Register 2 (QE type 3) */
+#define OP_RDSR2_3F          0x3F   /* Read Status Register 2 (QE type 3) */
+#define OP_BE32K             0x52   /* 32 KB Block Erase */
+#define OP_RDSFDP            0x5A   /* Read SFDP (1 dummy byte) */
+#define OP_4BE32K            0x5C   /* 32 KB Block Erase, 4-byte address */
+#define OP_BE                0x60   /* Bulk Erase */
+#define OP_QOR               0x6B   /* Quad Output Read (1 dummy byte) */
+#define OP_4QOR              0x6C   /* Quad Output Read, 4-byte address */
+#define OP_RDID              0x9F   /* Read JEDEC ID */
+#define OP_SE                0xD8   /* 64 KB Block Erase */
+#define OP_4SE               0xDC   /* Block Erase, 4-byte address */
+#define OP_QIOR              0xEB   /* Quad I/O Read */
+#define OP_4QIOR             0xEC   /* Quad I/O Read, 4-byte address */
+
+#define SR_WIP               0x01   /* Status: write in progress */
+#define SR_BP                0x1C   /* Status: block protection bits */
+#define SR_E_ERR             0x20   /* Status: erase error (S25FL) */
+#define SR_P_ERR             0x40   /* Status: program error (S25FL) */
+#define QE_SR1               0x40   /* Quad Enable: Status Register bit 6 */
+#define QE_SR2               0x02   /* Quad Enable: Status Register 2 bit 1 */
+#define QE_SR2_B7            0x80   /* Quad Enable: Status Register 2 bit 7 */
+#define QE_UNKNOWN           0xFF   /* Quad Enable method not known */
+
+#define SFDP_SIGNATURE 0x50444653   /* "SFDP" */
+#define SFDP_ID_4BAIT      0xFF84   /* 4-byte address instruction table ID */
+
+#define A4_READ          (1 << 1)   /* 4BAIT DWORD1: 0Ch supported */
+#define A4_QOR           (1 << 4)   /* 4BAIT DWORD1: 6Ch supported */
+#define A4_QIOR          (1 << 5)   /* 4BAIT DWORD1: ECh supported */
+#define A4_PP            (1 << 6)   /* 4BAIT DWORD1: 12h supported */
+#define A4_QPP           (1 << 7)   /* 4BAIT DWORD1: 34h supported */
+#define A4_ERASE(i)  (1 << (9 + (i)))  /* 4BAIT DWORD1: erase type i supported */
+#define A4_ALL         0xFFFFFFFF   /* devTab part: all 4-byte opcodes of Op4 */
+
+#define DEV_CAPS  (SPIFI_CAP_QUAD_READWRITE | SPIFI_CAP_FULLLOCK | \
+                   SPIFI_CAP_SUBBLKERASE | SPIFI_CAP_NOBLOCK)
+#define DEV_CAPS_S (SPIFI_CAP_QUAD_READWRITE | SPIFI_CAP_FULLLOCK | \
+                   SPIFI_CAP_NOBLOCK)        /* FL-S: 4 KB sectors at one end only */
+
+typedef struct {                             /* Supported device (no pointers, ROPI) */
+  char     name[12];                         /* device name */
+  uint8_t  id[3];                            /* JEDEC manufacturer, type, capacity */
+  uint8_t  ext;                              /* ID byte 5: sector architecture (0xFF - any) */
+  uint8_t  qe;                               /* Quad Enable method (JESD216 DWORD15) */
+  uint32_t caps;                             /* SPIFI_CAP_* */
+  uint16_t blks;                             /* number of blocks */
+  uint32_t blkSize;                          /* block size */
+  uint16_t subBlkSize;                       /* sub-block size (0 - none) */
+  uint16_t pageSize;                         /* page size */
+  uint8_t  quadProg;                         /* quad page program opcode (0 - none) */
+  uint32_t maxRead;                          /* fast read clock (Hz) */
+  uint32_t maxQuadRead;                      /* quad read clock (Hz) */
+  uint32_t maxProg;                          /* page program clock (Hz) */
+  uint32_t maxQuadProg;                      /* quad page program clock (Hz) */
+} DEV_T;
+
+typedef struct {                             /* Device context (in handle memory) */
+  uint32_t readCmd;                          /* read command: MCMD and command mode */
+  uint32_t readQuadCmd;                      /* quad read command (0 - none) */
+  uint32_t progCmd;                          /* page program command */
+  uint32_t progQuadCmd;                      /* quad page program command (0 - none) */
+  uint32_t eraseCmd;                         /* block erase command */
+  uint32_t subEraseCmd;                      /* sub-block erase command */
+  uint8_t  qe;                               /* Quad Enable method */
+  uint8_t  srErr;                            /* Status Register error bits */
+  uint8_t  quad;                             /* quad commands in use */
+  uint8_t  rsvd;
+} DRV_CTX_T;
+
+typedef struct {                             /* Handle memory layout */
+  SPIFI_HANDLE_T   handle;
+  SPIFI_INFODATA_T info;
+  DRV_CTX_T        ctx;
+} DRV_MEM_T;
+
+typedef struct {                             /* SFDP parameters found (diagnostics) */
+  uint32_t rev;                              /* basic table revision (major << 8 | minor) */
+  uint32_t size;                             /* density in bytes */
+  uint32_t eraseSize[4];                     /* erase type sizes (0 - none) */
+  uint8_t  eraseOp[4];                       /* erase type opcodes */
+  uint32_t eraseTime[4];                     /* erase type typical times (ms, 0 - unknown) */
+  uint32_t pageSize;                         /* page size */
+  uint32_t progTime;                         /* page program typical time (us) */
+  uint32_t chipTime;                         /* chip erase typical time (ms) */
+  uint32_t qe;                               /* Quad Enable method, QE_UNKNOWN */
+  uint32_t readMode;                         /* read used: 0x144, 0x114 or 0x111 */
+  uint32_t readOp;                           /* read opcode used */
+  uint32_t readClks;                         /* read dummy and mode clocks */
+  uint32_t addr4;                            /* 4BAIT DWORD1 support bits (0 - no table) */
+  uint8_t  erase4Op[4];                      /* erase type 4-byte address opcodes (0 - none) */
+} SFDP_T;
+
+static const DEV_T devTab[] = {
+  { "S25FL032P", { 0x01, 0x02, 0x15 }, 0xFF, 5, DEV_CAPS,    64, 0x10000, 0x1000, 256, OP_QPP,
+    104000000,  80000000, 104000000, 80000000 },
+  { "S25FL064P", { 0x01, 0x02, 0x16 }, 0xFF, 5, DEV_CAPS,   128, 0x10000, 0x1000, 256, OP_QPP,
+    104000000,  80000000, 104000000, 80000000 },
+  { "S25FL256S", { 0x01, 0x02, 0x19 }, 0x01, 5, DEV_CAPS_S, 512, 0x10000, 0,      256, OP_QPP,
+    133000000, 104000000, 133000000, 80000000 },
+  { "S25FL256S", { 0x01, 0x02, 0x19 }, 0x00, 5, DEV_CAPS_S, 128, 0x40000, 0,      256, OP_QPP,
+    133000000, 104000000, 133000000, 80000000 },
+  { "S25FL512S", { 0x01, 0x02, 0x20 }, 0xFF, 5, DEV_CAPS_S, 256, 0x40000, 0,      512, OP_QPP,
+    133000000, 104000000, 133000000, 80000000 },
+};
+#define DEV_NUM  (sizeof(devTab) / sizeof(devTab[0]))
+
+static uint32_t            ctrlBase;         /* SPIFI controller base address */
+static SPIFI_FAM_NODE_T   *famList;          /* registered families */
+static SPIFI_FAM_NODE_T    famNode;          /* common command set family */
+static SPIFI_FAM_DESC_T    famDesc;
+static SPIFI_FAM_NODE_T    sfdpNode;         /* SFDP family */
+static SPIFI_FAM_DESC_T    sfdpDesc;
+static SPIFI_FAM_FX_T      famFx;
+static SPIFI_DEV_NODE_T    devNode;
+static SPIFI_DEVICE_DATA_T devData;          /* detected device */
+static uint32_t            devCount;
+static uint32_t            sfdpCount;
+static uint32_t            dmaSaved;         /* GPDMA set up, restored by spifiDeInit */
+static uint32_t            saveDmaClk, saveDmaMux, saveDmaCfg;
+
+uint32_t dmaPages;                           /* Pages programmed by GPDMA */
+uint32_t cpuPages;                           /* Pages programmed by CPU writes */
+SFDP_T   sfdp;                               /* SFDP parameters of the device */
+
+
+/*  Wait for the end of the current SPIFI command
+ */
+
+static void CmdWait (void) {
+
+  while (SPIFI_STAT & STAT_CMD);
+}
+
+
+/*  Send a command without data and wait for its end
+ *    Parameter:      cmd:  SPIFI_CMD value
+ */
+
+static void CmdSend (uint32_t cmd) {
+
+  SPIFI_CMD = cmd;
+  CmdWait();
+}
+
+
+/*  Read a one byte device register
+ *    Parameter:      op:   Opcode (OP_RDSR, OP_RCR)
+ *    Return Value:   Register value
+ */
+
+static uint32_t RegRead (uint32_t op) {
+  uint32_t val;
+
+  SPIFI_CMD = CMD_OP(op) | FRAME_OP | 1;
+  val = SPIFI_DATA8;
+  CmdWait();
+
+  return (val);
+}
+
+
+/*  Wait until the device is ready, SPIFI polls the WIP bit in hardware
+ *    Return Value:   Status Register
+ */
+
+static uint32_t WaitReady (void) {
+  uint32_t sr;
+
+  SPIFI_CMD = CMD_OP(OP_RDSR) | FRAME_OP | CMD_POLL | 0;  /* until WIP = 0 */
+  sr = SPIFI_DATA8;
+  CmdWait();
+
+  return (sr);
+}
+
+
+/*  Write one or two register bytes and wait for completion
+ *    Parameter:      op:   Opcode (OP_WRR, OP_WRSR2, OP_WRSR2_3E)
+ *                    n:    Number of bytes (1, 2)
+ *                    b0:   First byte
+ *                    b1:   Second byte
+ */
+
+static void RegWrite (uint32_t op, uint32_t n, uint32_t b0, uint32_t b1) {
+
+  CmdSend(CMD_OP(OP_WREN) | FRAME_OP);
+  SPIFI_CMD   = CMD_OP(op) | FRAME_OP | CMD_DOUT | n;
+  SPIFI_DATA8 = (uint8_t)b0;
+  if (n > 1) {
+    SPIFI_DATA8 = (uint8_t)b1;
+  }
+  CmdWait();
+  WaitReady();
+}
+
+
+/*  Write the Status Register, keeping Status Register 2 where one byte
+ *  writes would clear it
+ */
+
+static void SrWrite (const DRV_CTX_T *ctx, uint32_t sr) {
+
+  switch (ctx->qe) {
+    case 1:
+    case 4:
+      RegWrite(OP_WRR, 2, sr, ctx->quad ? QE_SR2 : 0);
+      break;
+    case 5:
+      RegWrite(OP_WRR, 2, sr, RegRead(OP_RCR));
+      break;
+    default:
+      RegWrite(OP_WRR, 1, sr, 0);
+      break;
+  }
+}
+
+
+/*  Set or clear the Quad Enable bit by the JESD216 method of the device
+ *  (non-volatile bits are only written if they change)
+ *    Parameter:      qe:   Quad Enable method (0..6)
+ *                    on:   1 - set,  0 - clear
+ *    Return Value:   1 - QE as requested,  0 - Failed
+ */
+
+static int QeSet (uint32_t qe, uint32_t on) {
+  uint32_t op, bit, val;
+
+  switch (qe) {
+    case 0:                                  /* no QE bit */
+      return (1);
+    case 1:                                  /* SR2 bit 1, SR2 not readable */
+    case 4:
+      RegWrite(OP_WRR, 2, RegRead(OP_RDSR), on ? QE_SR2 : 0);
+      return (1);
+    case 2:                                  /* SR1 bit 6 */
+      op = OP_RDSR;
+      bit = QE_SR1;
+      break;
+    case 3:                                  /* SR2 bit 7, 3Fh / 3Eh */
+      op = OP_RDSR2_3F;
+      bit = QE_SR2_B7;
+      break;
+    case 5:                                  /* SR2 bit 1, 35h / 01h with SR1 */
+    case 6:                                  /* SR2 bit 1, 35h / 31h */
+      op = OP_RCR;
+      bit = QE_SR2;
+      break;
+    default:
+      return (0);
+  }
+
+  val = RegRead(op);
+  if (((val & bit) != 0) != (on != 0)) {
+    val = on ? (val | bit) : (val & ~bit);
+    switch (qe) {
+      case 2:  RegWrite(OP_WRR,      1, val, 0);                  break;
+      case 3:  RegWrite(OP_WRSR2_3E, 1, val, 0);                  break;
+      case 5:  RegWrite(OP_WRR,      2, RegRead(OP_RDSR), val);   break;
+      default: RegWrite(OP_WRSR2,    1, val, 0);                  break;
+    }
+  }
+
+  return (((RegRead(op) & bit) != 0) == (on != 0));
+}
+
+
+/*  Leave memory mode (abort of the memory mode command)
+ */
+
+static void MemModeOff (void) {
+
+  if (SPIFI_STAT & STAT_MCINIT) {
+    SPIFI_STAT = STAT_RESET;
+    while (SPIFI_STAT & STAT_RESET);
+  }
+}
+
+
+/*  Read the JEDEC ID
+ *    Parameter:      id:   Manufacturer, type, capacity, 2 extended bytes
+ */
+
+static void ReadId (uint8_t *id) {
+  int i;
+
+  MemModeOff();
+  SPIFI_CMD = CMD_OP(OP_RDID) | FRAME_OP | 5;
+  for (i = 0; i < 5; i++) {
+    id[i] = SPIFI_DATA8;
+  }
+  CmdWait();
+}
+
+
+/*  Look up a JEDEC ID in devTab
+ *    Return Value:   Index in devTab, -1 - not listed
+ */
+
+static int DevLookup (const uint8_t *id) {
+  int i;
+
+  for (i = 0; i < (int)DEV_NUM; i++) {
+    if ((devTab[i].id[0] == id[0]) && (devTab[i].id[1] == id[1]) &&
+        (devTab[i].id[2] == id[2]) && ((devTab[i].ext == 0xFF) || (devTab[i].ext == id[4]))) {
+      return (i);
+    }
+  }
+
+  return (-1);
+}
+
+
+/*  Status Register error bits: only S25FL-P/S report program and erase
+ *  errors there, other parts use these bits for protection or QE.
+ */
+
+static uint32_t SrErrBits (const uint8_t *id) {
+
+  return (((id[0] == 0x01) && (id[1] == 0x02)) ? (SR_P_ERR | SR_E_ERR) : 0);
+}
+
+
+/*  4-byte address opcode of a 3-byte address opcode
+ *  Erase opcodes are mapped by convention, SFDP lists its own (4BAIT).
+ *    Parameter:      op:   3-byte address opcode
+ *                    sup:  4BAIT DWORD1 support bits, A4_ALL
+ *    Return Value:   4-byte address opcode,  0 - none or not supported
+ */
+
+static uint32_t Op4 (uint32_t op, uint32_t sup) {
+  uint32_t op4, bit;
+
+  switch (op) {
+    case OP_FAST_READ: op4 = OP_4FAST_READ; bit = A4_READ; break;
+    case OP_QOR:       op4 = OP_4QOR;       bit = A4_QOR;  break;
+    case OP_QIOR:      op4 = OP_4QIOR;      bit = A4_QIOR; break;
+    case OP_PP:        op4 = OP_4PP;        bit = A4_PP;   break;
+    case OP_QPP:       op4 = OP_4QPP;       bit = A4_QPP;  break;
+    case OP_P4E:       op4 = OP_4P4E;       bit = sup;     break;
+    case OP_BE32K:     op4 = OP_4BE32K;     bit = sup;     break;
+    case OP_SE:        op4 = OP_4SE;        bit = sup;     break;
+    default:           return (0);
+  }
+
+  return ((sup & bit) ? op4 : 0);
+}
+
+
+/*  Command with an address: 3-byte opcode and frame, or 4-byte opcode
+ *  and frame for devices above 16 MB (no address mode switch, so the
+ *  device stays readable by 3-byte boot code after a reset)
+ *    Parameter:      op:   3-byte address opcode
+ *                    sup:  0 - 3-byte address, else 4-byte (see Op4)
+ *    Return Value:   SPIFI_CMD value,  0 - no 4-byte opcode
+ */
+
+static uint32_t AdrCmd (uint32_t op, uint32_t sup) {
+
+  if (sup == 0) {
+    return (CMD_OP(op) | FRAME_OP_A3);
+  }
+  op = Op4(op, sup);
+
+  return (op ? (CMD_OP(op) | FRAME_OP_A4) : 0);
+}
+
+
+/*  Device offset of an address (memory mapped or device relative)
+ */
+
+static uint32_t DevOfs (const SPIFI_HANDLE_T *pHandle, uint32_t addr) {
+  const SPIFI_INFODATA_T *pInfo = pHandle->pInfoData;
+
+  if (addr >= pInfo->baseAddr) {
+    addr -= pInfo->baseAddr;
+  }
+
+  return (addr);
+}
+
+
+/*  Size of the device
+ */
+
+static uint32_t DevSize (const SPIFI_HANDLE_T *pHandle) {
+
+  return (pHandle->pInfoData->numBlocks * pHandle->pInfoData->blockSize);
+}
+
+
+/*  Commands in use (quad if enabled and available)
+ */
+
+static uint32_t ReadCmd (const DRV_CTX_T *ctx) {
+
+  return ((ctx->quad && ctx->readQuadCmd) ? ctx->readQuadCmd : ctx->readCmd);
+}
+
+static uint32_t ProgCmd (const DRV_CTX_T *ctx) {
+
+  return ((ctx->quad && ctx->progQuadCmd) ? ctx->progQuadCmd : ctx->progCmd);
+}
+
+
+/*  End of a program or erase command: returns at once in non-blocking
+ *  mode, otherwise waits and checks the device error bit
+ *    Parameter:      errBit:  SR_P_ERR or SR_E_ERR
+ *                    err:     Error code reported for errBit
+ */
+
+static SPIFI_ERR_T OpDone (const SPIFI_HANDLE_T *pHandle, uint32_t errBit, SPIFI_ERR_T err) {
+  const DRV_CTX_T *ctx = (const DRV_CTX_T *)pHandle->pDevContext;
+
+  if (pHandle->pInfoData->opts & SPIFI_OPT_NOBLOCK) {
+    return (SPIFI_ERR_NONE);                 /* status polled by the caller */
+  }
+  if (WaitReady() & errBit & ctx->srErr) {
+    CmdSend(CMD_OP(OP_CLSR) | FRAME_OP);
+    return (err);
+  }
+
+  return (SPIFI_ERR_NONE);
+}
+
+
+/*  Issue an erase command (write enable first)
+ *    Parameter:      cmd:  Erase command (opcode and frame)
+ *                    ofs:  Device offset (not used by OP_BE)
+ */
+
+static SPIFI_ERR_T EraseCmd (const SPIFI_HANDLE_T *pHandle, uint32_t cmd, uint32_t ofs) {
+
+  if (SPIFI_STAT & STAT_MCINIT) {
+    return (SPIFI_ERR_MEMMODE);
+  }
+  CmdSend(CMD_OP(OP_WREN) | FRAME_OP);
+  SPIFI_ADDR = ofs;
+  CmdSend(cmd);
+
+  return (OpDone(pHandle, SR_E_ERR, SPIFI_ERR_ERASEERR));
+}
+
+
+/*  Page program data through GPDMA channel 0 (memory to SPIFI, flow
+ *  control by the SPIFI DMA request), command already issued
+ *    Parameter:      buf:  Data (word aligned)
+ *                    n:    Number of words
+ *    Return Value:   0 - OK,  1 - Failed (command aborted)
+ */
+
+static int ProgDma (const uint32_t *buf, uint32_t n) {
+  uint32_t tmo;
+
+  if (!dmaSaved) {
+    saveDmaClk           = CCU1_CLK_M3_DMA_CFG;
+    CCU1_CLK_M3_DMA_CFG |= 1;                /* GPDMA clock */
+    saveDmaMux           = CREG_DMAMUX;
+    saveDmaCfg           = GPDMA_CONFIG;
+    CREG_DMAMUX         &= ~3;               /* request line 0: SPIFI */
+    GPDMA_CONFIG         = 1;                /* GPDMA enable, little endian */
+    dmaSaved             = 1;
+  }
+  GPDMA_INTTCCLEAR  = 1;
+  GPDMA_INTERRCLR   = 1;
+  GPDMA_C0SRCADDR   = (uint32_t)buf;
+  GPDMA_C0DESTADDR  = ctrlBase + 0x14;       /* SPIFI_DATA */
+  GPDMA_C0LLI       = 0;
+  GPDMA_C0CONTROL   = n                      /* transfer size (words) */
+                    | (1 << 12) | (1 << 15)  /* burst 4 words */
+                    | (2 << 18) | (2 << 21)  /* 32-bit source and destination */
+                    | (1 << 25)              /* destination on AHB master 1 */
+                    | (1 << 26);             /* source increment */
+  SPIFI_CTRL       |= CTRL_DMAEN;
+  GPDMA_C0CONFIG    = 1                      /* enable */
+                    | (0 << 6)               /* destination: SPIFI request */
+                    | (1 << 11);             /* memory to peripheral */
+
+  for (tmo = DMA_TMO; tmo; tmo--) {
+    if (GPDMA_RAWINTTCSTAT & 1) {
+      break;
+    }
+    if (GPDMA_RAWINTERRSTAT & 1) {
+      tmo = 0;
+      break;
+    }
+  }
+  GPDMA_C0CONFIG = 0;
+  SPIFI_CTRL    &= ~CTRL_DMAEN;
+
+  if (tmo == 0) {
+    SPIFI_STAT = STAT_RESET;                 /* abort program command */
+    while (SPIFI_STAT & STAT_RESET);
+    return (1);
+  }
+  CmdWait();
+
+  return (0);
+}
+
+
+/*  Family function: lock or unlock the device (block protection bits)
+ */
+
+static SPIFI_ERR_T FxLockCmd (const SPIFI_HANDLE_T *pHandle, SPIFI_PCMD_LOCK_UNLOCK_T cmd, uint32_t data) {
+  uint32_t sr;
+
+  (void)data;                                /* no per-block argument */
+  if ((cmd != SPIFI_PCMD_UNLOCK_DEVICE) && (cmd != SPIFI_PCMD_LOCK_DEVICE)) {
+    return (SPIFI_ERR_NOTSUPPORTED);         /* no individual block lock */
+  }
+  if (SPIFI_STAT & STAT_MCINIT) {
+    return (SPIFI_ERR_MEMMODE);
+  }
+  sr = RegRead(OP_RDSR);
+  sr = (cmd == SPIFI_PCMD_LOCK_DEVICE) ? (sr | SR_BP) : (sr & ~SR_BP);
+  SrWrite((const DRV_CTX_T *)pHandle->pDevContext, sr);
+
+  return (SPIFI_ERR_NONE);
+}
+
+
+/*  Family function: erase the whole device
+ */
+
+static SPIFI_ERR_T FxEraseAll (const SPIFI_HANDLE_T *pHandle) {
+
+  return (EraseCmd(pHandle, CMD_OP(OP_BE) | FRAME_OP, 0));
+}
+
+
+/*  Family function: erase a block
+ */
+
+static SPIFI_ERR_T FxEraseBlock (const SPIFI_HANDLE_T *pHandle, uint32_t blockNum) {
+  const DRV_CTX_T *ctx = (const DRV_CTX_T *)pHandle->pDevContext;
+
+  if (blockNum >= pHandle->pInfoData->numBlocks) {
+    return (SPIFI_ERR_RANGE);
+  }
+
+  return (EraseCmd(pHandle, ctx->eraseCmd, blockNum * pHandle->pInfoData->blockSize));
+}
+
+
+/*  Family function: erase a sub-block
+ */
+
+static SPIFI_ERR_T FxEraseSubBlock (const SPIFI_HANDLE_T *pHandle, uint32_t subBlockNum) {
+  const DRV_CTX_T *ctx = (const DRV_CTX_T *)pHandle->pDevContext;
+
+  if (subBlockNum >= pHandle->pInfoData->numSubBlocks) {
+    return (SPIFI_ERR_RANGE);
+  }
+
+  return (EraseCmd(pHandle, ctx->subEraseCmd, subBlockNum * pHandle->pInfoData->subBlockSize));
+}
+
+
+/*  Family function: program up to a page
+ *  Data is streamed by GPDMA when buffer and size are word aligned.
+ */
+
+static SPIFI_ERR_T FxPageProgram (const SPIFI_HANDLE_T *pHandle, uint32_t addr, const uint32_t *writeBuff, uint32_t bytes) {
+  const DRV_CTX_T *ctx = (const DRV_CTX_T *)pHandle->pDevContext;
+  const uint8_t   *p8;
+  uint32_t         ofs, page, n;
+
+  ofs  = DevOfs(pHandle, addr);
+  page = pHandle->pInfoData->pageSize;
+  if ((bytes == 0) || (bytes > page - (ofs & (page - 1)))) {
+    return (SPIFI_ERR_PAGESIZE);
+  }
+  if (ofs + bytes > DevSize(pHandle)) {
+    return (SPIFI_ERR_RANGE);
+  }
+  if (SPIFI_STAT & STAT_MCINIT) {
+    return (SPIFI_ERR_MEMMODE);
+  }
+
+  CmdSend(CMD_OP(OP_WREN) | FRAME_OP);
+  SPIFI_ADDR = ofs;
+  SPIFI_CMD  = ProgCmd(ctx) | CMD_DOUT | bytes;
+
+  if (SPIFI_DMA && ((((uint32_t)writeBuff) & 3) == 0) && ((bytes & 3) == 0)) {
+    if (ProgDma(writeBuff, bytes / 4)) {
+      return (SPIFI_ERR_PROGERR);
+    }
+    dmaPages++;
+  } else {
+    for (n = bytes; n >= 4; n -= 4) {
+      SPIFI_DATA = *writeBuff++;
+    }
+    for (p8 = (const uint8_t *)writeBuff; n > 0; n--) {
+      SPIFI_DATA8 = *p8++;
+    }
+    CmdWait();
+    cpuPages++;
+  }
+
+  return (OpDone(pHandle, SR_P_ERR, SPIFI_ERR_PROGERR));
+}
+
+
+/*  Family function: read an address range in command mode
+ */
+
+static SPIFI_ERR_T FxRead (const SPIFI_HANDLE_T *pHandle, uint32_t addr, uint32_t *readBuff, uint32_t bytes) {
+  const DRV_CTX_T *ctx = (const DRV_CTX_T *)pHandle->pDevContext;
+  uint8_t         *p8;
+  uint32_t         ofs, n;
+
+  ofs = DevOfs(pHandle, addr);
+  if (bytes > pHandle->pInfoData->maxReadSize) {
+    return (SPIFI_ERR_GEN);
+  }
+  if (ofs + bytes > DevSize(pHandle)) {
+    return (SPIFI_ERR_RANGE);
+  }
+  if (SPIFI_STAT & STAT_MCINIT) {
+    return (SPIFI_ERR_MEMMODE);
+  }
+  if (bytes == 0) {
+    return (SPIFI_ERR_NONE);
+  }
+
+  SPIFI_ADDR = ofs;
+  SPIFI_CMD  = ReadCmd(ctx) | bytes;
+  for (n = bytes; n >= 4; n -= 4) {
+    *readBuff++ = SPIFI_DATA;
+  }
+  for (p8 = (uint8_t *)readBuff; n > 0; n--) {
+    *p8++ = SPIFI_DATA8;
+  }
+  CmdWait();
+
+  return (SPIFI_ERR_NONE);
+}
+
+
+/*  Family function: set or clear options
+ *  Quad I/O sets the Quad Enable bit by the method of the device and
+ *  switches to the quad read and program commands found at setup.
+ */
+
+static SPIFI_ERR_T FxSetOpts (const SPIFI_HANDLE_T *pHandle, uint32_t options, uint8_t set) {
+  SPIFI_INFODATA_T *pInfo = pHandle->pInfoData;
+  DRV_CTX_T        *ctx   = (DRV_CTX_T *)pHandle->pDevContext;
+
+  if (options & ~pInfo->pDeviceData->caps) {
+    return (SPIFI_ERR_NOTSUPPORTED);
+  }
+  if (SPIFI_STAT & STAT_MCINIT) {
+    return (SPIFI_ERR_MEMMODE);
+  }
+
+  if (options & SPIFI_OPT_USE_QUAD) {
+    ctx->quad = 0;
+    if (!QeSet(ctx->qe, set)) {
+      return (SPIFI_ERR_GEN);                /* QE not read back */
+    }
+    ctx->quad = set ? 1 : 0;
+  }
+
+  if (set) {
+    pInfo->opts |= options;
+  } else {
+    pInfo->opts &= ~options;
+  }
+
+  return (SPIFI_ERR_NONE);
+}
+
+
+/*  Family function: reset (command mode, error bits cleared)
+ */
+
+static SPIFI_ERR_T FxReset (const SPIFI_HANDLE_T *pHandle) {
+  const DRV_CTX_T *ctx = (const DRV_CTX_T *)pHandle->pDevContext;
+
+  MemModeOff();
+  WaitReady();
+  if (ctx->srErr) {
+    CmdSend(CMD_OP(OP_CLSR) | FRAME_OP);
+  }
+
+  return (SPIFI_ERR_NONE);
+}
+
+
+/*  Family function: device status as SPIFI_STAT_* bits
+ *    Parameter:      clear:  Clear the device error bits once not busy
+ */
+
+static uint32_t FxGetStatus (const SPIFI_HANDLE_T *pHandle, uint8_t clear) {
+  const DRV_CTX_T *ctx = (const DRV_CTX_T *)pHandle->pDevContext;
+  uint32_t         sr, stat;
+
+  if (SPIFI_STAT & STAT_MCINIT) {
+    return (0);                              /* memory mode: device idle */
+  }
+  sr   = RegRead(OP_RDSR);
+  stat = 0;
+  if (sr & SR_WIP) {
+    stat |= SPIFI_STAT_BUSY;
+  }
+  if ((sr & SR_BP) == SR_BP) {
+    stat |= SPIFI_STAT_ISWP | SPIFI_STAT_FULLLOCK;
+  } else if (sr & SR_BP) {
+    stat |= SPIFI_STAT_ISWP | SPIFI_STAT_PARTLOCK;
+  }
+  sr &= ctx->srErr;
+  if (sr & SR_P_ERR) {
+    stat |= SPIFI_STAT_PROGERR;
+  }
+  if (sr & SR_E_ERR) {
+    stat |= SPIFI_STAT_ERASEERR;
+  }
+  if (clear && !(stat & SPIFI_STAT_BUSY) && sr) {
+    CmdSend(CMD_OP(OP_CLSR) | FRAME_OP);
+  }
+
+  return (stat);
+}
+
+
+/*  Family function: sub-block conversions
+ */
+
+static uint32_t FxSubBlockCmd (const SPIFI_HANDLE_T *pHandle, SPIFI_PCMD_SUBBLK_T cmd, uint32_t val) {
+  const SPIFI_INFODATA_T *pInfo = pHandle->pInfoData;
+
+  switch (cmd) {
+    case SPIFI_PCMD_ADDR_TO_SUB_BLOCK:
+      val = DevOfs(pHandle, val);
+      return ((val < DevSize(pHandle)) ? (val / pInfo->subBlockSize) : 0xFFFFFFFF);
+    case SPIFI_PCMD_SUB_BLOCK_TO_ADDR:
+      return ((val < pInfo->numSubBlocks) ? (pInfo->baseAddr + val * pInfo->subBlockSize) : 0xFFFFFFFF);
+    case SPIFI_PCMD_BLOCK_TO_SUB_BLOCK:
+      return ((val < pInfo->numBlocks) ? (val * (pInfo->blockSize / pInfo->subBlockSize)) : 0xFFFFFFFF);
+  }
+
+  return (0xFFFFFFFF);
+}
+
+
+/*  Handle setup from devData (filled by the family setup)
+ *  The function table is filled at run time, see ROPI note above.
+ */
+
+static void HandleSetup (SPIFI_HANDLE_T *pHandle, uint32_t spifiCtrlAddr, uint32_t baseAddr) {
+  SPIFI_INFODATA_T *pInfo = pHandle->pInfoData;
+
+  famFx.lockCmd       = FxLockCmd;
+  famFx.eraseAll      = FxEraseAll;
+  famFx.eraseBlock    = FxEraseBlock;
+  famFx.eraseSubBlock = FxEraseSubBlock;
+  famFx.pageProgram   = FxPageProgram;
+  famFx.read          = FxRead;
+  famFx.setOpts       = FxSetOpts;
+  famFx.reset         = FxReset;
+  famFx.getStatus     = FxGetStatus;
+  famFx.subBlockCmd   = FxSubBlockCmd;
+  devNode.pDevData    = &devData;
+
+  pHandle->pFamFx      = &famFx;
+  pInfo->spifiCtrlAddr = spifiCtrlAddr;
+  pInfo->baseAddr      = baseAddr;
+  pInfo->numBlocks     = devData.blks;
+  pInfo->blockSize     = devData.blkSize;
+  pInfo->numSubBlocks  = devData.subBlks;
+  pInfo->subBlockSize  = devData.subBlkSize ? devData.subBlkSize : devData.blkSize;
+  pInfo->pageSize      = devData.pageSize;
+  pInfo->maxReadSize   = devData.maxReadSize;
+  pInfo->pDeviceData   = &devData;
+  pInfo->opts          = 0;
+  pInfo->pDevName      = devData.pDevName;
+  pInfo->lastErr       = SPIFI_ERR_NONE;
+  pInfo->pId           = &devData.id;
+}
+
+
+/*  Family setup: common command set, device from devTab by JEDEC ID
+ *  Devices above 16 MB use the 4-byte address opcodes.
+ */
+
+static SPIFI_ERR_T FamSetup (SPIFI_HANDLE_T *pHandle, uint32_t spifiCtrlAddr, uint32_t baseAddr) {
+  DRV_CTX_T   *ctx = (DRV_CTX_T *)pHandle->pDevContext;
+  const DEV_T *dev;
+  uint8_t      id[5];
+  uint32_t     size, sub, sup;
+  int          i;
+
+  ReadId(id);
+  i = DevLookup(id);
+  if (i < 0) {
+    return (SPIFI_ERR_NOTSUPPORTED);
+  }
+  dev  = &devTab[i];
+  size = dev->blks * dev->blkSize;
+  sub  = dev->subBlkSize ? dev->subBlkSize : dev->blkSize;
+  sup  = (size > ADDR3_MAX) ? A4_ALL : 0;
+
+  devData.pDevName           = dev->name;
+  devData.id.mfgId[0]        = id[0];
+  devData.id.mfgId[1]        = id[1];
+  devData.id.mfgId[2]        = id[2];
+  devData.id.extCount        = 0;
+  devData.caps               = dev->caps;
+  devData.blks               = dev->blks;
+  devData.blkSize            = dev->blkSize;
+  devData.subBlks            = (uint16_t)(size / sub);
+  devData.subBlkSize         = dev->subBlkSize;
+  devData.pageSize           = dev->pageSize;
+  devData.maxReadSize        = CMD_LEN_MAX & ~3;
+  devData.maxClkRate         = dev->maxProg;
+  devData.maxReadRate        = dev->maxRead;
+  devData.maxQuadReadRate    = dev->maxQuadRead;
+  devData.maxProgramRate     = dev->maxProg;
+  devData.maxQuadProgramRate = dev->maxQuadProg;
+
+  ctx->readCmd     = AdrCmd(OP_FAST_READ, sup) | CMD_INTLEN(1);
+  ctx->readQuadCmd = AdrCmd(OP_QOR, sup) | FIELD_QDATA | CMD_INTLEN(1);
+  ctx->progCmd     = AdrCmd(OP_PP, sup);
+  ctx->progQuadCmd = dev->quadProg ? (AdrCmd(dev->quadProg, sup) | FIELD_QDATA) : 0;
+  ctx->eraseCmd    = AdrCmd(OP_SE, sup);
+  ctx->subEraseCmd = dev->subBlkSize ? AdrCmd(OP_P4E, sup) : ctx->eraseCmd;
+  ctx->qe          = dev->qe;
+  ctx->srErr       = (uint8_t)SrErrBits(id);
+  ctx->quad        = 0;
+
+  HandleSetup(pHandle, spifiCtrlAddr, baseAddr);
+
+  return (SPIFI_ERR_NONE);
+}
+
+
+/*  Read SFDP data (single I/O, 8 dummy clocks)
+ *    Parameter:      ofs:  SFDP address
+ *                    buf:  Buffer
+ *                    n:    Number of 32-bit words
+ */
+
+static void SfdpRead (uint32_t ofs, uint32_t *buf, uint32_t n) {
+
+  SPIFI_ADDR = ofs;
+  SPIFI_CMD  = CMD_OP(OP_RDSFDP) | FRAME_OP_A3 | CMD_INTLEN(1) | (n * 4);
+  for ( ; n > 0; n--) {
+    *buf++ = SPIFI_DATA;
+  }
+  CmdWait();
+}
+
+
+/*  Parse the JESD216 basic flash parameter table into sfdp
+ *  Read commands: 1-4-4 is preferred over 1-1-4 when its dummy and mode
+ *  clocks fill whole bytes, fast read (1-1-1) is always available.
+ *  The 4-byte address instruction table (JESD216B) is looked up in the
+ *  further parameter headers.
+ *    Return Value:   1 - OK,  0 - no SFDP
+ */
+
+static int SfdpParse (void) {
+  uint32_t hdr[2], bt[SFDP_DWORDS];
+  uint32_t i, n, v, unit, nph;
+
+  SfdpRead(0, hdr, 2);
+  if (hdr[0] != SFDP_SIGNATURE) {
+    return (0);
+  }
+  nph = (hdr[1] >> 16) & 0xFF;               /* parameter headers - 1 */
+  SfdpRead(8, hdr, 2);                       /* first header: basic table */
+  if ((hdr[0] & 0xFF) != 0x00) {
+    return (0);
+  }
+  n = hdr[0] >> 24;                          /* table length (DWORDs) */
+  if (n < 9) {
+    return (0);
+  }
+  if (n > SFDP_DWORDS) {
+    n = SFDP_DWORDS;
+  }
+  for (i = n; i < SFDP_DWORDS; i++) {
+    bt[i] = 0;
+  }
+  SfdpRead(hdr[1] & 0xFFFFFF, bt, n);
+
+  sfdp.rev = (hdr[0] >> 8) & 0xFFFF;        /* major, minor */
+
+  v = bt[1];                                 /* DWORD2: density (bits) */
+  if (v & 0x80000000) {
+    v &= 0x7FFFFFFF;
+    sfdp.size = (v >= 35) ? 0x80000000 : ((v >= 3) ? (1UL << (v - 3)) : 0);
+  } else {
+    sfdp.size = (v >> 3) + 1;
+  }
+
+  for (i = 0; i < 4; i++) {                  /* DWORD8, 9: erase types */
+    v = bt[7 + (i >> 1)] >> ((i & 1) * 16);
+    sfdp.eraseSize[i] = ((v & 0xFF) != 0) ? (1UL << (v & 0xFF)) : 0;
+    sfdp.eraseOp[i]   = (uint8_t)(v >> 8);
+    sfdp.eraseTime[i] = 0;
+  }
+  if ((sfdp.eraseSize[0] == 0) && ((bt[0] & 3) == 1)) {
+    sfdp.eraseSize[0] = 0x1000;              /* DWORD1: 4 KB erase */
+    sfdp.eraseOp[0]   = (uint8_t)(bt[0] >> 8);
+  }
+
+  sfdp.pageSize = 256;
+  sfdp.progTime = 0;
+  sfdp.chipTime = 0;
+  sfdp.qe       = QE_UNKNOWN;
+  if (n >= 11) {                             /* JESD216A: DWORD10, 11 */
+    for (i = 0; i < 4; i++) {
+      v = bt[9] >> (4 + 7 * i);
+      unit = ((v >> 5) & 3) == 0 ? 1 : ((v >> 5) & 3) == 1 ? 16 : ((v >> 5) & 3) == 2 ? 128 : 1000;
+      sfdp.eraseTime[i] = sfdp.eraseSize[i] ? ((v & 0x1F) + 1) * unit : 0;
+    }
+    v = bt[10];
+    sfdp.pageSize = 1UL << ((v >> 4) & 0xF);
+    sfdp.progTime = (((v >> 8) & 0x1F) + 1) * ((v & (1 << 13)) ? 64 : 8);
+    unit = ((v >> 29) & 3) == 0 ? 16 : ((v >> 29) & 3) == 1 ? 256 : ((v >> 29) & 3) == 2 ? 4000 : 64000;
+    sfdp.chipTime = (((v >> 24) & 0x1F) + 1) * unit;
+  }
+  if (n >= 15) {                             /* JESD216A: DWORD15 */
+    sfdp.qe = (bt[14] >> 20) & 7;
+    if (sfdp.qe == 7) {
+      sfdp.qe = QE_UNKNOWN;
+    }
+  }
+
+  sfdp.readMode = 0x111;
+  sfdp.readOp   = OP_FAST_READ;
+  sfdp.readClks = 8;
+  v = bt[2];                                 /* DWORD3: quad read modes */
+  if ((bt[0] & (1 << 21)) && ((((v & 0x1F) + ((v >> 5) & 7)) % 2) == 0)) {
+    sfdp.readMode = 0x144;
+    sfdp.readOp   = (v >> 8) & 0xFF;
+    sfdp.readClks = (v & 0x1F) + ((v >> 5) & 7);
+  } else if ((bt[0] & (1 << 22)) && (((((v >> 16) & 0x1F) + ((v >> 21) & 7)) % 8) == 0)) {
+    sfdp.readMode = 0x114;
+    sfdp.readOp   = v >> 24;
+    sfdp.readClks = ((v >> 16) & 0x1F) + ((v >> 21) & 7);
+  }
+
+  sfdp.addr4 = 0;
+  for (i = 0; i < 4; i++) {                  /* by convention if no table */
+    sfdp.erase4Op[i] = (uint8_t)Op4(sfdp.eraseOp[i], A4_ALL);
+  }
+  for (i = 1; i <= nph; i++) {
+    SfdpRead(8 + 8 * i, hdr, 2);
+    if ((((hdr[1] >> 16) & 0xFF00) | (hdr[0] & 0xFF)) != SFDP_ID_4BAIT) {
+      continue;
+    }
+    if ((hdr[0] >> 24) < 2) {
+      break;
+    }
+    SfdpRead(hdr[1] & 0xFFFFFF, bt, 2);
+    sfdp.addr4 = bt[0] | 1;                  /* bit 0 (13h, not used) marks the table found */
+    for (n = 0; n < 4; n++) {
+      sfdp.erase4Op[n] = (bt[0] & A4_ERASE(n)) ? (uint8_t)(bt[1] >> (8 * n)) : 0;
+    }
+    break;
+  }
+
+  return (1);
+}
+
+
+/*  Family setup: SFDP device
+ *  Block erase uses the largest erase type, sub-block erase the 4 KB
+ *  type. devTab entries still provide clock limits, a quad program
+ *  opcode (not part of the basic table) and the Quad Enable method of
+ *  JESD216 rev. 1.0 tables, otherwise SFDP_CLOCK applies and programming
+ *  stays single I/O. Above 16 MB the 4-byte address opcodes are used if
+ *  the 4-byte address instruction table lists them (devTab parts: by
+ *  convention), otherwise the device is used up to 16 MB.
+ */
+
+static SPIFI_ERR_T SfdpSetup (SPIFI_HANDLE_T *pHandle, uint32_t spifiCtrlAddr, uint32_t baseAddr) {
+  DRV_CTX_T   *ctx = (DRV_CTX_T *)pHandle->pDevContext;
+  const DEV_T *dev = 0;
+  uint8_t      id[5];
+  uint32_t     i, blk, sub, size, sup, qe;
+  int          k;
+
+  ReadId(id);
+  if (!SfdpParse()) {
+    return (SPIFI_ERR_NOTSUPPORTED);
+  }
+  k = DevLookup(id);
+  if (k >= 0) {
+    dev = &devTab[k];
+  }
+
+  blk = 4;
+  sub = 4;
+  for (i = 0; i < 4; i++) {
+    if ((sfdp.eraseSize[i] != 0) && ((blk == 4) || (sfdp.eraseSize[i] > sfdp.eraseSize[blk]))) {
+      blk = i;
+    }
+    if (sfdp.eraseSize[i] == 0x1000) {
+      sub = i;
+    }
+  }
+  if (blk == 4) {
+    return (SPIFI_ERR_NOTSUPPORTED);         /* no erase type */
+  }
+  if ((sub == 4) || (dev && !(dev->caps & SPIFI_CAP_SUBBLKERASE))) {
+    sub = blk;                               /* FL-S: 4 KB sectors at one end only */
+  }
+  size = sfdp.size;
+  if (size > MEM_WINDOW) {
+    size = MEM_WINDOW;
+  }
+  sup = 0;
+  if (size > ADDR3_MAX) {
+    sup = sfdp.addr4 ? sfdp.addr4 : (dev ? A4_ALL : 0);
+    if (!Op4(OP_FAST_READ, sup) || !Op4(OP_PP, sup) || !sfdp.erase4Op[blk]) {
+      sup  = 0;
+      size = ADDR3_MAX;                      /* 3-byte addresses */
+    } else if (!sfdp.erase4Op[sub]) {
+      sub  = blk;
+    }
+  }
+  if (size < sfdp.eraseSize[blk]) {
+    return (SPIFI_ERR_NOTSUPPORTED);
+  }
+  qe = sfdp.qe;
+  if ((qe == QE_UNKNOWN) && dev) {
+    qe = dev->qe;
+  }
+
+  devData.pDevName    = dev ? dev->name : "SFDP Flash";
+  devData.id.mfgId[0] = id[0];
+  devData.id.mfgId[1] = id[1];
+  devData.id.mfgId[2] = id[2];
+  devData.id.extCount = 0;
+  devData.caps        = SPIFI_CAP_NOBLOCK;
+  if (sub != blk) {
+    devData.caps     |= SPIFI_CAP_SUBBLKERASE;
+  }
+  if ((sfdp.readMode != 0x111) && (qe != QE_UNKNOWN)) {
+    devData.caps     |= SPIFI_CAP_QUAD_READWRITE;
+  }
+  devData.blks        = (uint16_t)(size / sfdp.eraseSize[blk]);
+  devData.blkSize     = sfdp.eraseSize[blk];
+  devData.subBlks     = (uint16_t)(size / sfdp.eraseSize[sub]);
+  devData.subBlkSize  = (sub != blk) ? (uint16_t)sfdp.eraseSize[sub] : 0;
+  devData.pageSize    = (uint16_t)sfdp.pageSize;
+  devData.maxReadSize = CMD_LEN_MAX & ~3;
+  devData.maxClkRate         = dev ? dev->maxProg     : SFDP_CLOCK;
+  devData.maxReadRate        = dev ? dev->maxRead     : SFDP_CLOCK;
+  devData.maxQuadReadRate    = dev ? dev->maxQuadRead : SFDP_CLOCK;
+  devData.maxProgramRate     = dev ? dev->maxProg     : SFDP_CLOCK;
+  devData.maxQuadProgramRate = dev ? dev->maxQuadProg : SFDP_CLOCK;
+
+  ctx->readCmd     = AdrCmd(OP_FAST_READ, sup) | CMD_INTLEN(1);
+  ctx->readQuadCmd = 0;
+  if (sfdp.readMode != 0x111) {
+    ctx->readQuadCmd = AdrCmd(sfdp.readOp, sup);
+  }
+  if (ctx->readQuadCmd == 0) {
+    devData.caps    &= ~SPIFI_CAP_QUAD_READWRITE;  /* no 4-byte quad read */
+  } else if (sfdp.readMode == 0x144) {       /* quad intermediate: 2 clocks per byte */
+    ctx->readQuadCmd |= FIELD_QADDR | CMD_INTLEN(sfdp.readClks / 2);
+  } else {                                   /* serial intermediate: 8 clocks per byte */
+    ctx->readQuadCmd |= FIELD_QDATA | CMD_INTLEN(sfdp.readClks / 8);
+  }
+  ctx->progCmd     = AdrCmd(OP_PP, sup);
+  ctx->progQuadCmd = 0;
+  if (dev && dev->quadProg) {
+    ctx->progQuadCmd = AdrCmd(dev->quadProg, sup);
+  } else if (sup && (sfdp.addr4 & A4_QPP)) {
+    ctx->progQuadCmd = AdrCmd(OP_QPP, sup);  /* listed by the 4BAIT table */
+  }
+  if (ctx->progQuadCmd) {
+    ctx->progQuadCmd |= FIELD_QDATA;
+  }
+  if (sup) {
+    ctx->eraseCmd    = CMD_OP(sfdp.erase4Op[blk]) | FRAME_OP_A4;
+    ctx->subEraseCmd = CMD_OP(sfdp.erase4Op[sub]) | FRAME_OP_A4;
+  } else {
+    ctx->eraseCmd    = CMD_OP(sfdp.eraseOp[blk]) | FRAME_OP_A3;
+    ctx->subEraseCmd = CMD_OP(sfdp.eraseOp[sub]) | FRAME_OP_A3;
+  }
+  ctx->qe          = (uint8_t)qe;
+  ctx->srErr       = (uint8_t)SrErrBits(id);
+  ctx->quad        = 0;
+  SPIFI_IDATA      = 0xFF;                   /* mode bits: no continuous read */
+
+  HandleSetup(pHandle, spifiCtrlAddr, baseAddr);
+
+  return (SPIFI_ERR_NONE);
+}
+
+
+/*  Register the common command set family (S25FL032P/064P, S25FL256S/512S)
+ */
+
+SPIFI_FAM_NODE_T *spifi_REG_FAMILY_CommonCommandSet (void) {
+
+  devCount               = DEV_NUM;
+  famDesc.pFamName       = "Common Command Set";
+  famDesc.pDevList       = &devNode;
+  famDesc.prvContextSize = sizeof(DRV_CTX_T);
+  famDesc.pDevCount      = &devCount;
+  famDesc.pPrvDevGetID   = 0;
+  famDesc.pPrvDevSetup   = FamSetup;
+  famNode.pDesc          = &famDesc;
+
+  return (&famNode);
+}
+
+
+/*  Register the SFDP family (any JESD216 device, tried before the
+ *  common command set when registered after it)
+ */
+
+SPIFI_FAM_NODE_T *spifi_REG_FAMILY_SFDP (void) {
+
+  sfdpCount               = 1;               /* generic device */
+  sfdpDesc.pFamName       = "SFDP";
+  sfdpDesc.pDevList       = &devNode;
+  sfdpDesc.prvContextSize = sizeof(DRV_CTX_T);
+  sfdpDesc.pDevCount      = &sfdpCount;
+  sfdpDesc.pPrvDevGetID   = 0;
+  sfdpDesc.pPrvDevSetup   = SfdpSetup;
+  sfdpNode.pDesc          = &sfdpDesc;
+
+  return (&sfdpNode);
+}
+
+
+uint16_t spifiGetLibVersion (void) {
+
+  return (DRV_VERSION);
+}
+
+
+SPIFI_ERR_T spifiInit (uint32_t spifiCtrlAddr, uint8_t reset) {
+
+  ctrlBase = spifiCtrlAddr;
+  famList  = 0;
+  if (reset) {
+    SPIFI_STAT = STAT_RESET;
+    while (SPIFI_STAT & STAT_RESET);
+  }
+  SPIFI_CTRL = CTRL_DEF;
+
+  return (SPIFI_ERR_NONE);
+}
+
+
+void spifiDeInit (void) {
+
+  famList = 0;
+  if (dmaSaved) {                            /* GPDMA as found (clock last) */
+    GPDMA_CONFIG        = saveDmaCfg;
+    CREG_DMAMUX         = saveDmaMux;
+    CCU1_CLK_M3_DMA_CFG = saveDmaClk;
+    dmaSaved            = 0;
+  }
+}
+
+
+SPIFI_FAM_NODE_T *spifiRegisterFamily (SPIFI_FAM_NODE_T *(*regFx)(void)) {
+  SPIFI_FAM_NODE_T *node, *p;
+
+  node = regFx();
+  for (p = famList; p != 0; p = p->pNext) {
+    if (p == node) {
+      return (node);                         /* already registered */
+    }
+  }
+  node->pNext = famList;
+  famList     = node;
+
+  return (node);
+}
+
+
+/*  Set up a handle by the first registered family supporting the device
+ *    Return Value:   1 - OK,  0 - no supported device
+ */
+
+static int DevSetup (DRV_MEM_T *m, uint32_t spifiCtrlAddr, uint32_t baseAddr) {
+  SPIFI_FAM_NODE_T *fam;
+
+  ctrlBase = spifiCtrlAddr;
+  m->handle.pInfoData   = &m->info;
+  m->handle.pDevContext = &m->ctx;
+  for (fam = famList; fam != 0; fam = fam->pNext) {
+    if (fam->pDesc->pPrvDevSetup(&m->handle, spifiCtrlAddr, baseAddr) == SPIFI_ERR_NONE) {
+      return (1);
+    }
+  }
+
+  return (0);
+}
+
+
+uint32_t spifiGetHandleMemSize (uint32_t spifiCtrlAddr) {
+  DRV_MEM_T m;
+
+  if (!DevSetup(&m, spifiCtrlAddr, 0)) {
+    return (0);                              /* no supported device */
+  }
+
+  return (sizeof(DRV_MEM_T));
+}
+
+
+SPIFI_HANDLE_T *spifiInitDevice (void *pMem, uint32_t sizePMem, uint32_t spifiCtrlAddr, uint32_t baseAddr) {
+  DRV_MEM_T *m = (DRV_MEM_T *)pMem;
+
+  if ((sizePMem < sizeof(DRV_MEM_T)) || !DevSetup(m, spifiCtrlAddr, baseAddr)) {
+    return (0);
+  }
+
+  return (&m->handle);
+}
+
+
+SPIFI_ERR_T spifiDevInit (const SPIFI_HANDLE_T *pHandle) {
+
+  return (pHandle->pFamFx->reset(pHandle));
+}
+
+
+SPIFI_ERR_T spifiDevDeInit (const SPIFI_HANDLE_T *pHandle) {
+
+  return (spifiDevSetMemMode(pHandle, true));
+}
+
+
+SPIFI_ERR_T spifiDevSetMemMode (const SPIFI_HANDLE_T *pHandle, uint8_t enMMode) {
+  const DRV_CTX_T *ctx = (const DRV_CTX_T *)pHandle->pDevContext;
+
+  if (!enMMode) {
+    MemModeOff();
+    return (SPIFI_ERR_NONE);
+  }
+  if (SPIFI_STAT & STAT_MCINIT) {
+    return (SPIFI_ERR_NONE);
+  }
+  WaitReady();                               /* no reads while busy */
+  SPIFI_MCMD = ReadCmd(ctx);
+
+  return (SPIFI_ERR_NONE);
+}
+
+
+uint8_t spifiDevGetMemoryMode (const SPIFI_HANDLE_T *pHandle) {
+
+  (void)pHandle;                             /* one SPIFI controller */
+  return ((SPIFI_STAT & STAT_MCINIT) != 0);
+}
+
+
+SPIFI_ERR_T spifiDevSetOpts (SPIFI_HANDLE_T *pHandle, uint32_t options, uint8_t set) {
+
+  return (pHandle->pFamFx->setOpts(pHandle, options, set));
+}
+
+
+uint32_t spifiDevGetInfo (const SPIFI_HANDLE_T *pHandle, SPIFI_INFO_ID_T infoId) {
+  const SPIFI_INFODATA_T    *pInfo = pHandle->pInfoData;
+  const SPIFI_DEVICE_DATA_T *pDev  = pInfo->pDeviceData;
+
+  switch (infoId) {
+    case SPIFI_INFO_DEVSIZE:             return (DevSize(pHandle));
+    case SPIFI_INFO_ERASE_BLOCKS:        return (pInfo->numBlocks);
+    case SPIFI_INFO_ERASE_BLOCKSIZE:     return (pInfo->blockSize);
+    case SPIFI_INFO_ERASE_SUBBLOCKS:     return (pInfo->numSubBlocks);
+    case SPIFI_INFO_ERASE_SUBBLOCKSIZE:  return (pInfo->subBlockSize);
+    case SPIFI_INFO_PAGESIZE:            return (pInfo->pageSize);
+    case SPIFI_INFO_MAXREADSIZE:         return (pInfo->maxReadSize);
+    case SPIFI_INFO_MAXCLOCK:            return (pDev->maxClkRate);
+    case SPIFI_INFO_MAX_READ_CLOCK:      return (pDev->maxReadRate);
+    case SPIFI_INFO_MAX_QUADREAD_CLOCK:  return (pDev->maxQuadReadRate);
+    case SPIFI_INFO_MAX_PROG_CLOCK:      return (pDev->maxProgramRate);
+    case SPIFI_INFO_MAX_QUADPROG_CLOCK:  return (pDev->maxQuadProgramRate);
+    case SPIFI_INFO_CAPS:                return (pDev->caps);
+    case SPIFI_INFO_STATUS:              return (pHandle->pFamFx->getStatus(pHandle, true));
+    case SPIFI_INFO_STATUS_RETAIN:       return (pHandle->pFamFx->getStatus(pHandle, false));
+    case SPIFI_INFO_OPTIONS:             return (pInfo->opts);
+    default:                             break;
+  }
+
+  return (0);
+}
+
+
+uint32_t spifiGetAddrFromBlock (const SPIFI_HANDLE_T *pHandle, uint32_t blockNum) {
+  const SPIFI_INFODATA_T *pInfo = pHandle->pInfoData;
+
+  if (blockNum >= pInfo->numBlocks) {
+    return (0xFFFFFFFF);
+  }
+
+  return (pInfo->baseAddr + blockNum * pInfo->blockSize);
+}
+
+
+uint32_t spifiGetAddrFromSubBlock (const SPIFI_HANDLE_T *pHandle, uint32_t subBlockNum) {
+
+  return (pHandle->pFamFx->subBlockCmd(pHandle, SPIFI_PCMD_SUB_BLOCK_TO_ADDR, subBlockNum));
+}
+
+
+uint32_t spifiGetBlockFromAddr (const SPIFI_HANDLE_T *pHandle, uint32_t addr) {
+  uint32_t ofs = DevOfs(pHandle, addr);
+
+  if (ofs >= DevSize(pHandle)) {
+    return (0xFFFFFFFF);
+  }
+
+  return (ofs / pHandle->pInfoData->blockSize);
+}
+
+
+uint32_t spifiGetSubBlockFromAddr (const SPIFI_HANDLE_T *pHandle, uint32_t addr) {
+
+  return (pHandle->pFamFx->subBlockCmd(pHandle, SPIFI_PCMD_ADDR_TO_SUB_BLOCK, addr));
+}
+
+
+uint32_t spifiGetSubBlockFromBlock (const SPIFI_HANDLE_T *pHandle, uint32_t blockNum) {
+
+  return (pHandle->pFamFx->subBlockCmd(pHandle, SPIFI_PCMD_BLOCK_TO_SUB_BLOCK, blockNum));
+}
+
+
+/*  Program any size in page steps; in non-blocking mode only the last
+ *  page is left running
+ */
+
+SPIFI_ERR_T spifiProgram (const SPIFI_HANDLE_T *pHandle, uint32_t addr, const uint32_t *writeBuff, uint32_t bytes) {
+  const DRV_CTX_T *ctx = (const DRV_CTX_T *)pHandle->pDevContext;
+  const uint8_t   *p8  = (const uint8_t *)writeBuff;
+  SPIFI_ERR_T err = SPIFI_ERR_NONE;
+  uint32_t    page, n;
+
+  page = pHandle->pInfoData->pageSize;
+  while (bytes > 0) {
+    n = page - (DevOfs(pHandle, addr) & (page - 1));
+    if (n > bytes) {
+      n = bytes;
+    }
+    err = pHandle->pFamFx->pageProgram(pHandle, addr, (const uint32_t *)p8, n);
+    if (err != SPIFI_ERR_NONE) {
+      break;
+    }
+    addr  += n;
+    p8    += n;                              /* pages may end unaligned */
+    bytes -= n;
+    if ((bytes > 0) && (pHandle->pInfoData->opts & SPIFI_OPT_NOBLOCK) &&
+        (WaitReady() & SR_P_ERR & ctx->srErr)) {
+      err = SPIFI_ERR_PROGERR;
+      break;
+    }
+  }
+  pHandle->pInfoData->lastErr = err;
+
+  return (err);
+}
+
+
+SPIFI_ERR_T spifiRead (const SPIFI_HANDLE_T *pHandle, uint32_t addr, uint32_t *readBuff, uint32_t bytes) {
+  uint8_t    *p8 = (uint8_t *)readBuff;
+  SPIFI_ERR_T err = SPIFI_ERR_NONE;
+  uint32_t    n;
+
+  while (bytes > 0) {
+    n = pHandle->pInfoData->maxReadSize;
+    if (n > bytes) {
+      n = bytes;
+    }
+    err = pHandle->pFamFx->read(pHandle, addr, (uint32_t *)p8, n);
+    if (err != SPIFI_ERR_NONE) {
+      break;
+    }
+    addr  += n;
+    p8    += n;
+    bytes -= n;
+  }
+  pHandle->pInfoData->lastErr = err;
+
+  return (err);
+}
+
+
+/*  Erase blocks; in non-blocking mode only the last block is left running
+ */
+
+SPIFI_ERR_T spifiErase (const SPIFI_HANDLE_T *pHandle, uint32_t firstBlock, uint32_t numBlocks) {
+  const DRV_CTX_T *ctx = (const DRV_CTX_T *)pHandle->pDevContext;
+  SPIFI_ERR_T err = SPIFI_ERR_NONE;
+
+  if ((firstBlock + numBlocks) > pHandle->pInfoData->numBlocks) {
+    err = SPIFI_ERR_RANGE;
+  }
+  for ( ; (err == SPIFI_ERR_NONE) && (numBlocks > 0); firstBlock++, numBlocks--) {
+    err = pHandle->pFamFx->eraseBlock(pHandle, firstBlock);
+    if ((err == SPIFI_ERR_NONE) && (numBlocks > 1) &&
+        (pHandle->pInfoData->opts & SPIFI_OPT_NOBLOCK) && (WaitReady() & SR_E_ERR & ctx->srErr)) {
+      err = SPIFI_ERR_ERASEERR;
+    }
+  }
+  pHandle->pInfoData->lastErr = err;
+
+  return (err);
+}
+
+
+SPIFI_ERR_T spifiEraseByAddr (const SPIFI_HANDLE_T *pHandle, uint32_t firstAddr, uint32_t lastAddr) {
+  uint32_t first, last;
+
+  first = spifiGetBlockFromAddr(pHandle, firstAddr);
+  last  = spifiGetBlockFromAddr(pHandle, lastAddr);
+  if ((first == 0xFFFFFFFF) || (last == 0xFFFFFFFF) || (last < first)) {
+    return (SPIFI_ERR_RANGE);
+  }
+
+  return (spifiErase(pHandle, first, last - first + 1));
+}
+
+#endif /* SPIFI_DRV_OPEN */